@@ -20,6 +20,7 @@ SOURCES += main.cpp\
     utility.cpp
 
 HEADERS  += mainwindow.h \
+    binarymesh.h \
     mainview.h \
     model.h \
     vertex.h
@@ -0,0 +1,72 @@
+#ifndef BINARYMESH_H_
+#define BINARYMESH_H_
+
+#include <cstdint>
+#include <cstring>
+
+// The binary mesh format (.bmesh): a mesh converted from an .obj file once
+// (see RayTracer2/Tools/meshconvert.cpp), which loaders map instead of
+// parsing text. The file is this header followed by arrays of the unique
+// vertices, each aligned to 16 bytes: positions (3 floats per vertex),
+// normals (3 floats, if NORMALS is set) and texture coordinates (2 floats,
+// if TEX_COORDS is set), and an index buffer (a uint32_t per corner, three
+// per triangle). Values are stored little endian.
+//
+// The ray tracer (RayTracer2) and the OpenGL viewer (OpenGL3) each have a
+// copy of this header; keep the copies the same.
+struct BinaryMeshHeader {
+  enum Flags : uint32_t { NORMALS = 1, TEX_COORDS = 2 };
+  enum : uint32_t { VERSION = 1 };
+
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t flags;
+  uint32_t numVertices;
+  uint64_t numIndices;
+  float bounds[6]; // min x, y, z, max x, y, z of the positions
+  uint64_t positionsOffset;
+  uint64_t normalsOffset;   // 0 without normals
+  uint64_t texCoordsOffset; // 0 without texture coordinates
+  uint64_t indicesOffset;
+  uint64_t fileSize;
+
+  // Whether data starts like a binary mesh
+  static bool matches(char const *data, uint64_t size) {
+    return size >= sizeof(BinaryMeshHeader) &&
+           memcmp(data, "BMESH\0\0", 8) == 0;
+  }
+
+  // Sets the magic, the version and the offsets from the counts and flags
+  void layout() {
+    memcpy(magic, "BMESH\0\0", 8);
+    version = VERSION;
+    headerSize = sizeof(BinaryMeshHeader);
+    uint64_t offset = align(headerSize);
+    positionsOffset = offset;
+    offset = align(offset + 12 * uint64_t(numVertices));
+    normalsOffset = flags & NORMALS ? offset : 0;
+    if (flags & NORMALS)
+      offset = align(offset + 12 * uint64_t(numVertices));
+    texCoordsOffset = flags & TEX_COORDS ? offset : 0;
+    if (flags & TEX_COORDS)
+      offset = align(offset + 8 * uint64_t(numVertices));
+    indicesOffset = offset;
+    fileSize = offset + 4 * numIndices;
+  }
+
+  // Whether the header is the one layout() gives, for a file of size bytes.
+  // The indices are not checked.
+  bool valid(uint64_t size) const {
+    BinaryMeshHeader expected = *this;
+    expected.layout();
+    return memcmp(this, &expected, sizeof(BinaryMeshHeader)) == 0 &&
+           (flags & ~(NORMALS | TEX_COORDS)) == 0 && numIndices % 3 == 0 &&
+           fileSize == size;
+  }
+
+private:
+  static uint64_t align(uint64_t offset) { return (offset + 15) / 16 * 16; }
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "model.h"
 
+#include "binarymesh.h"
+
+#include <QByteArray>
 #include <QDebug>
 #include <QFile>
 #include <QTextStream>
@@ -29,6 +32,11 @@ struct Vertex {
 
 Model::Model(QString filename) {
   qDebug() << ":: Loading model:" << filename;
+  if (filename.endsWith(".bmesh")) {
+    loadBinary(filename);
+    return;
+  }
+
   QFile file(filename);
   if (file.open(QIODevice::ReadOnly)) {
     QTextStream in(&file);
@@ -71,6 +79,88 @@ Model::Model(QString filename) {
   }
 }
 
+/**
+ * @brief Model::loadBinary
+ *
+ * Reads a binary mesh, whose vertices are already unique and indexed as
+ * alignData() makes them. Files are mapped; resources are already in
+ * memory, unless they were compressed.
+ */
+void Model::loadBinary(QString filename) {
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qDebug() << "Could not open" << filename;
+    return;
+  }
+
+  QByteArray contents;
+  qint64 size = file.size();
+  char const *data = reinterpret_cast<char const *>(file.map(0, size));
+  if (!data) {
+    contents = file.readAll();
+    data = contents.constData();
+  }
+
+  BinaryMeshHeader header;
+  bool valid = BinaryMeshHeader::matches(data, size);
+  if (valid) {
+    memcpy(&header, data, sizeof(header));
+    valid = header.valid(size);
+  }
+  if (!valid) {
+    qDebug() << "Invalid binary mesh" << filename;
+    return;
+  }
+
+  hNorms = header.flags & BinaryMeshHeader::NORMALS;
+  hTexs = header.flags & BinaryMeshHeader::TEX_COORDS;
+  float const *positions =
+      reinterpret_cast<float const *>(data + header.positionsOffset);
+  float const *normalData =
+      reinterpret_cast<float const *>(data + header.normalsOffset);
+  float const *texData =
+      reinterpret_cast<float const *>(data + header.texCoordsOffset);
+  quint32 const *indexData =
+      reinterpret_cast<quint32 const *>(data + header.indicesOffset);
+
+  int numVertices = header.numVertices;
+  vertices_indexed.reserve(numVertices);
+  normals_indexed.reserve(numVertices);
+  textureCoords_indexed.reserve(numVertices);
+  for (int i = 0; i != numVertices; ++i) {
+    vertices_indexed.append(QVector3D(positions[3 * i], positions[3 * i + 1],
+                                      positions[3 * i + 2]));
+    normals_indexed.append(hNorms ? QVector3D(normalData[3 * i],
+                                              normalData[3 * i + 1],
+                                              normalData[3 * i + 2])
+                                  : QVector3D(0, 0, 0));
+    textureCoords_indexed.append(hTexs ? QVector2D(texData[2 * i],
+                                                   texData[2 * i + 1])
+                                       : QVector2D(0, 0));
+  }
+
+  int numIndices = header.numIndices;
+  indices.reserve(numIndices);
+  for (int i = 0; i != numIndices; ++i) {
+    if (indexData[i] >= header.numVertices) {
+      qDebug() << "Invalid index in binary mesh" << filename;
+      indices.clear();
+      break;
+    }
+    indices.append(indexData[i]);
+  }
+
+  // The arrays for glDrawArrays()
+  vertices.reserve(indices.size());
+  for (unsigned index : indices) {
+    vertices.append(vertices_indexed[index]);
+    if (hNorms)
+      normals.append(normals_indexed[index]);
+    if (hTexs)
+      textureCoords.append(textureCoords_indexed[index]);
+  }
+}
+
 /**
  * @brief Model::unitze Not Implemented yet!
  *
@@ -10,7 +10,8 @@
 /**
  * @brief The Model class
  *
- * Loads all data from a Wavefront .obj file
+ * Loads all data from a Wavefront .obj file, or from a binary mesh
+ * (.bmesh, see binarymesh.h) which is mapped instead of parsed
  * IMPORTANT! Current only supports TRIANGLE meshes!
  *
  * Support for other meshes can be implemented by students
@@ -46,6 +47,9 @@ public:
   void unitize();
 
 private:
+  // Binary mesh loading
+  void loadBinary(QString filename);
+
   // OBJ parsing
   void parseVertex(QStringList tokens);
   void parseNormal(QStringList tokens);
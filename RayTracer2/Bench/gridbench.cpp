@@ -0,0 +1,201 @@
+// Benchmark of the accelerators on a particle-style scene: many spheres of
+// about the same size spread uniformly through a cube, as generated below.
+// Rays from the eye of the generated scene through random points of the
+// image plane are traced through the linear loop, the BVH and the grid,
+// once looking for the closest hit and once for any hit (as shadow rays
+// do), and all three are checked to find the same hits.
+//
+// Optionally the generated scene is also written as name-none.json,
+// name-bvh.json and name-grid.json, which differ only in the accelerator,
+// such that the full renders can be compared with the raytracer as well.
+//
+// usage: gridbench [number of spheres] [number of rays] [scene name]
+
+#include "../Code/accelerators/bvhaccelerator.h"
+#include "../Code/accelerators/gridaccelerator.h"
+#include "../Code/accelerators/linearaccelerator.h"
+#include "../Code/shapes/sphere.h"
+
+#include "../Code/json/json.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+// The spheres fill [0, SIZE]^3 - (0, 0, SIZE / 2), the eye looks at them
+// from above the middle of the image plane z = 0, as in the example scenes
+double const SIZE = 400.0;
+Point const EYE(SIZE / 2.0, SIZE / 2.0, 1000.0);
+
+struct Particle {
+  Point center;
+  double radius;
+  Color color;
+};
+
+// The radius scales with the spacing of the spheres, such that a ray passes
+// about as many spheres whatever their number (3 for 2000 spheres)
+vector<Particle> generate(unsigned numSpheres, mt19937 &random) {
+  double meanRadius = 3.0 * cbrt(2000.0 / numSpheres);
+  uniform_real_distribution<double> position(0.0, SIZE);
+  uniform_real_distribution<double> radius(0.8 * meanRadius,
+                                           1.2 * meanRadius);
+  uniform_real_distribution<double> channel(0.0, 1.0);
+
+  vector<Particle> particles;
+  for (unsigned idx = 0; idx != numSpheres; ++idx) {
+    Point center(position(random), position(random),
+                 position(random) - SIZE / 2.0);
+    particles.push_back(
+        Particle{center, radius(random),
+                 Color(channel(random), channel(random), channel(random))});
+  }
+  return particles;
+}
+
+void writeScene(vector<Particle> const &particles, string const &name) {
+  json scene;
+  scene["Eye"] = {EYE.x, EYE.y, EYE.z};
+  scene["Shadows"] = true;
+  scene["MaxRecursionDepth"] = 2;
+  scene["Lights"] = {
+      {{"position", {-200, 600, 1500}}, {"color", {0.6, 0.6, 0.6}}},
+      {{"position", {600, 600, 1500}}, {"color", {0.5, 0.5, 0.4}}}};
+  json objects = json::array();
+  for (Particle const &particle : particles) {
+    objects.push_back(
+        {{"type", "sphere"},
+         {"position",
+          {particle.center.x, particle.center.y, particle.center.z}},
+         {"radius", particle.radius},
+         {"material",
+          {{"color", {particle.color.r, particle.color.g, particle.color.b}},
+           {"ka", 0.2},
+           {"kd", 0.7},
+           {"ks", 0.3},
+           {"n", 16}}}});
+  }
+  scene["Objects"] = objects;
+
+  for (string accelerator : {"none", "bvh", "grid"}) {
+    scene["Accelerator"] = accelerator;
+    string filename = name + "-" + accelerator + ".json";
+    ofstream file(filename);
+    file << scene << '\n';
+    if (!file)
+      cerr << "Could not write " << filename << ".\n";
+    else
+      cout << "Wrote " << filename << ".\n";
+  }
+}
+
+struct Result {
+  Object const *object;
+  double t;
+};
+
+// Best time of a few runs of the tracing, the accelerators are built once
+unsigned const RUNS = 3;
+
+template <typename Trace> double timeIt(unsigned runs, Trace &&trace) {
+  double best = INFINITY;
+  for (unsigned run = 0; run != runs; ++run) {
+    auto start = chrono::steady_clock::now();
+    trace();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count());
+  }
+  return best;
+}
+
+vector<Result> closest(Accelerator &accelerator, vector<Ray> const &rays) {
+  vector<Result> results;
+  results.reserve(rays.size());
+  for (Ray ray : rays) {
+    Hit hit(Hit::NO_HIT());
+    ObjectPtr obj = accelerator.intersect(ray, hit);
+    results.push_back(Result{obj.get(), obj ? hit.t : 0.0});
+  }
+  return results;
+}
+
+vector<bool> blocked(Accelerator &accelerator, vector<Ray> const &rays) {
+  vector<bool> results;
+  results.reserve(rays.size());
+  for (Ray const &ray : rays)
+    results.push_back(accelerator.occluder(ray) != nullptr);
+  return results;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned numSpheres = argc > 1 ? atoi(argv[1]) : 20000;
+  unsigned numRays = argc > 2 ? atoi(argv[2]) : 4096;
+
+  mt19937 random(42);
+  vector<Particle> particles = generate(numSpheres, random);
+  if (argc > 3)
+    writeScene(particles, argv[3]);
+
+  vector<ObjectPtr> objects;
+  for (Particle const &particle : particles)
+    objects.push_back(
+        ObjectPtr(new Sphere(particle.center, particle.radius)));
+
+  uniform_real_distribution<double> target(0.0, SIZE);
+  vector<Ray> rays;
+  for (unsigned idx = 0; idx != numRays; ++idx) {
+    Point pixel(target(random), target(random), 0.0);
+    rays.push_back(Ray(EYE, (pixel - EYE).normalized()));
+  }
+
+  char const *names[] = {"linear", "bvh", "grid"};
+  AcceleratorPtr accelerators[] = {
+      AcceleratorPtr(new LinearAccelerator()),
+      AcceleratorPtr(new BVHAccelerator()),
+      AcceleratorPtr(new GridAccelerator())};
+
+  cout << numRays << " rays against " << numSpheres << " spheres.\n";
+  vector<Result> expected;
+  vector<bool> expectedBlocked;
+  double linearTime = 0.0;
+  unsigned mismatches = 0;
+  for (unsigned idx = 0; idx != 3; ++idx) {
+    Accelerator &accelerator = *accelerators[idx];
+    double buildTime = timeIt(1, [&] { accelerator.build(objects); });
+
+    vector<Result> hits;
+    vector<bool> anyHits;
+    double closestTime =
+        timeIt(RUNS, [&] { hits = closest(accelerator, rays); });
+    double blockedTime =
+        timeIt(RUNS, [&] { anyHits = blocked(accelerator, rays); });
+
+    if (idx == 0) {
+      expected = hits;
+      expectedBlocked = anyHits;
+      linearTime = closestTime;
+    }
+    for (unsigned ray = 0; ray != numRays; ++ray)
+      if (hits[ray].object != expected[ray].object ||
+          hits[ray].t != expected[ray].t ||
+          anyHits[ray] != expectedBlocked[ray])
+        ++mismatches;
+
+    cout << names[idx] << ": build " << buildTime << " s, closest hit "
+         << closestTime / numRays * 1e6 << " us per ray ("
+         << linearTime / closestTime << "x), any hit "
+         << blockedTime / numRays * 1e6 << " us per ray.\n";
+  }
+  cout << mismatches << " results differ.\n";
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+// Microbenchmark of the sphere intersection. Every ray is tested against
+// all spheres, looking for the closest hit: once through Sphere::intersect
+// (a virtual call, and a normal for every sphere hit) and once through a
+// SphereArray (four spheres at a time, a normal for the closest hit only).
+//
+// usage: spherebench [number of spheres] [number of rays]
+
+#include "../Code/shapes/spherearray.h"
+#include "../Code/shapes/sphere.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Result {
+  unsigned object;
+  Hit hit;
+};
+
+vector<Result> traceObjects(vector<ObjectPtr> const &objects,
+                            vector<Ray> const &rays) {
+  vector<Result> results;
+  results.reserve(rays.size());
+  for (Ray ray : rays) {
+    Result result{numeric_limits<unsigned>::max(), Hit::NO_HIT()};
+    for (unsigned idx = 0; idx != objects.size(); ++idx) {
+      Hit hit(objects[idx]->intersect(ray));
+      if (ray.contains(hit.t)) {
+        ray.tmax = hit.t;
+        result = Result{idx, hit};
+      }
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+vector<Result> traceArray(vector<ObjectPtr> const &objects,
+                          SphereArray const &spheres,
+                          vector<Ray> const &rays) {
+  vector<Result> results;
+  results.reserve(rays.size());
+  for (Ray ray : rays) {
+    Result result{numeric_limits<unsigned>::max(), Hit::NO_HIT()};
+    for (unsigned first = 0; first < objects.size(); first += 4) {
+      unsigned count = objects.size() - first < 4 ? objects.size() - first : 4;
+      double t[4];
+      unsigned mask = spheres.intersect(ray, first, count, t);
+      for (unsigned lane = 0; lane != count; ++lane) {
+        if ((mask & (1u << lane)) && ray.contains(t[lane])) {
+          ray.tmax = t[lane];
+          result.object = first + lane;
+        }
+      }
+    }
+    if (result.object != numeric_limits<unsigned>::max()) {
+      Sphere const &sphere = static_cast<Sphere const &>(
+          *objects[result.object]);
+      result.hit = Hit(ray.tmax, sphere.normal(ray, ray.tmax));
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+template <typename Trace> double timeIt(Trace &&trace) {
+  auto start = chrono::steady_clock::now();
+  trace();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned numSpheres = argc > 1 ? atoi(argv[1]) : 1024;
+  unsigned numRays = argc > 2 ? atoi(argv[2]) : 4096;
+
+  mt19937 random(42);
+  uniform_real_distribution<double> position(-100.0, 100.0);
+  uniform_real_distribution<double> radius(0.5, 5.0);
+  uniform_real_distribution<double> direction(-1.0, 1.0);
+
+  vector<ObjectPtr> objects;
+  vector<unsigned> order;
+  for (unsigned idx = 0; idx != numSpheres; ++idx) {
+    Point center(position(random), position(random), position(random));
+    objects.push_back(ObjectPtr(new Sphere(center, radius(random))));
+    order.push_back(idx);
+  }
+  SphereArray spheres;
+  spheres.build(objects, order.data(), order.size());
+
+  vector<Ray> rays;
+  for (unsigned idx = 0; idx != numRays; ++idx) {
+    Point origin(position(random), position(random), position(random));
+    Vector D(direction(random), direction(random), direction(random));
+    rays.push_back(Ray(origin, D.normalized()));
+  }
+
+  vector<Result> expected, actual;
+  double objectTime = timeIt([&] { expected = traceObjects(objects, rays); });
+  double arrayTime =
+      timeIt([&] { actual = traceArray(objects, spheres, rays); });
+
+  unsigned hits = 0;
+  unsigned mismatches = 0;
+  for (unsigned idx = 0; idx != numRays; ++idx) {
+    if (expected[idx].object != numeric_limits<unsigned>::max())
+      ++hits;
+    if (expected[idx].object != actual[idx].object ||
+        (expected[idx].hit.t != actual[idx].hit.t &&
+         !(std::isnan(expected[idx].hit.t) && std::isnan(actual[idx].hit.t))))
+      ++mismatches;
+    else if (expected[idx].object != numeric_limits<unsigned>::max())
+      for (int axis = 0; axis != 3; ++axis)
+        if (expected[idx].hit.N.data[axis] != actual[idx].hit.N.data[axis])
+          ++mismatches;
+  }
+
+  double tests = double(numSpheres) * numRays;
+  cout << numRays << " rays against " << numSpheres << " spheres, " << hits
+       << " hit something.\n";
+  cout << "Sphere::intersect: " << objectTime << " seconds ("
+       << objectTime / tests * 1e9 << " ns per test).\n";
+  cout << "SphereArray:       " << arrayTime << " seconds ("
+       << arrayTime / tests * 1e9 << " ns per test, "
+       << objectTime / arrayTime << "x).\n";
+  cout << mismatches << " results differ.\n";
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// Benchmark of texture sampling as a texture-heavy scene does it: a
+// rotated, textured sphere filling a square image of the given resolution
+// (as in scene02-texture.json), one sample per pixel in row major order.
+// The texture is sampled with every filter, stored row major and tiled,
+// and both layouts are checked to give the same colors.
+//
+// usage: texturebench [texture .png] [resolution]
+
+#include "../Code/shapes/sphere.h"
+#include "../Code/texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Sample {
+  TextureCoordinates uv, dx, dy;
+};
+
+// The texture coordinates of the sphere at every pixel it covers, with the
+// changes to the next pixel in x and y as footprint
+vector<Sample> samples(unsigned resolution) {
+  double radius = 0.45 * resolution;
+  Point center(resolution / 2.0, resolution / 2.0, 0.0);
+  Sphere sphere(center, radius);
+  sphere.setRotation(Vector(0.0, 1.0, 0.7), 90.0);
+
+  vector<TextureCoordinates> uv(size_t(resolution) * resolution);
+  vector<bool> hit(uv.size());
+  for (unsigned y = 0; y != resolution; ++y) {
+    for (unsigned x = 0; x != resolution; ++x) {
+      Ray ray(Point(x + 0.5, y + 0.5, 2.0 * resolution),
+              Vector(0.0, 0.0, -1.0));
+      Hit sphereHit(sphere.intersect(ray));
+      size_t idx = size_t(y) * resolution + x;
+      hit[idx] = ray.contains(sphereHit.t);
+      if (hit[idx])
+        uv[idx] = sphere.textureCoordinates(ray.at(sphereHit.t));
+    }
+  }
+
+  auto difference = [](TextureCoordinates a, TextureCoordinates b) {
+    TextureCoordinates d{a.u - b.u, a.v - b.v};
+    d.u -= round(d.u); // u wraps around
+    return d;
+  };
+
+  vector<Sample> result;
+  for (unsigned y = 0; y + 1 < resolution; ++y) {
+    for (unsigned x = 0; x + 1 < resolution; ++x) {
+      size_t idx = size_t(y) * resolution + x;
+      if (!hit[idx] || !hit[idx + 1] || !hit[idx + resolution])
+        continue;
+      result.push_back(Sample{uv[idx], difference(uv[idx + 1], uv[idx]),
+                              difference(uv[idx + resolution], uv[idx])});
+    }
+  }
+  return result;
+}
+
+// Best time of a few runs
+unsigned const RUNS = 5;
+
+double sampleAll(Texture const &texture, vector<Sample> const &samples,
+                 Texture::Filter filter, vector<Color> &colors) {
+  colors.resize(samples.size());
+  double best = INFINITY;
+  for (unsigned run = 0; run != RUNS; ++run) {
+    auto start = chrono::steady_clock::now();
+    for (size_t idx = 0; idx != samples.size(); ++idx)
+      colors[idx] = texture.sample(samples[idx].uv, samples[idx].dx,
+                                   samples[idx].dy, filter);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    best = min(best, elapsed.count());
+  }
+  return best;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  string filename = argc > 1 ? argv[1] : "../scenes/earthmap1k.png";
+  unsigned resolution = argc > 2 ? atoi(argv[2]) : 2048;
+
+  Texture rowMajor(filename, Texture::ROW_MAJOR);
+  Texture tiled(filename, Texture::TILED);
+  vector<Sample> pixels = samples(resolution);
+  cout << filename << " (" << tiled.width() << "x" << tiled.height()
+       << ", " << tiled.memoryUsage() / 1024 << " KiB) on " << pixels.size()
+       << " pixels of a " << resolution << "x" << resolution << " image.\n";
+
+  char const *names[] = {"nearest", "bilinear", "trilinear", "anisotropic"};
+  unsigned mismatches = 0;
+  for (int filter = Texture::NEAREST; filter <= Texture::ANISOTROPIC;
+       ++filter) {
+    vector<Color> expected, actual;
+    double rowMajorTime = sampleAll(rowMajor, pixels,
+                                    Texture::Filter(filter), expected);
+    double tiledTime =
+        sampleAll(tiled, pixels, Texture::Filter(filter), actual);
+    for (size_t idx = 0; idx != pixels.size(); ++idx)
+      for (int channel = 0; channel != 3; ++channel)
+        if (expected[idx].data[channel] != actual[idx].data[channel])
+          ++mismatches;
+
+    cout << names[filter] << ": row major " << rowMajorTime * 1e9 /
+                                                   pixels.size()
+         << " ns, tiled " << tiledTime * 1e9 / pixels.size()
+         << " ns per sample (" << rowMajorTime / tiledTime << "x).\n";
+  }
+  cout << mismatches << " colors differ.\n";
+  return mismatches == 0 ? 0 : 1;
+}
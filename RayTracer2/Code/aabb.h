@@ -0,0 +1,118 @@
+#ifndef AABB_H_
+#define AABB_H_
+
+#include "ray.h"
+#include "triple.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Axis aligned bounding box, used by the acceleration structures
+class AABB {
+public:
+  Point min; // lower corner
+  Point max; // upper corner
+
+  // An empty box, extending it with anything yields that thing
+  AABB()
+      : min(std::numeric_limits<double>::infinity(),
+            std::numeric_limits<double>::infinity(),
+            std::numeric_limits<double>::infinity()),
+        max(-std::numeric_limits<double>::infinity(),
+            -std::numeric_limits<double>::infinity(),
+            -std::numeric_limits<double>::infinity()) {}
+
+  AABB(Point const &lower, Point const &upper) : min(lower), max(upper) {}
+
+  // A box covering all of space, used by unbounded objects (planes)
+  static AABB const INFINITE() {
+    static AABB infinite(Point(-std::numeric_limits<double>::infinity(),
+                               -std::numeric_limits<double>::infinity(),
+                               -std::numeric_limits<double>::infinity()),
+                         Point(std::numeric_limits<double>::infinity(),
+                               std::numeric_limits<double>::infinity(),
+                               std::numeric_limits<double>::infinity()));
+    return infinite;
+  }
+
+  void extend(Point const &point) {
+    for (int axis = 0; axis != 3; ++axis) {
+      min.data[axis] = std::min(min.data[axis], point.data[axis]);
+      max.data[axis] = std::max(max.data[axis], point.data[axis]);
+    }
+  }
+
+  void extend(AABB const &box) {
+    for (int axis = 0; axis != 3; ++axis) {
+      min.data[axis] = std::min(min.data[axis], box.min.data[axis]);
+      max.data[axis] = std::max(max.data[axis], box.max.data[axis]);
+    }
+  }
+
+  bool isEmpty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  // Infinite boxes do not fit in a hierarchy, so we have to tell them apart
+  bool isFinite() const {
+    for (int axis = 0; axis != 3; ++axis)
+      if (!(std::abs(min.data[axis]) < std::numeric_limits<double>::max() &&
+            std::abs(max.data[axis]) < std::numeric_limits<double>::max()))
+        return false;
+    return true;
+  }
+
+  double center(int axis) const {
+    return 0.5 * (min.data[axis] + max.data[axis]);
+  }
+
+  double extent(int axis) const { return max.data[axis] - min.data[axis]; }
+
+  // Index of the axis with the largest extent
+  int longestAxis() const {
+    int axis = extent(0) > extent(1) ? 0 : 1;
+    return extent(2) > extent(axis) ? 2 : axis;
+  }
+
+  double surfaceArea() const {
+    if (isEmpty())
+      return 0.0;
+    double dx = extent(0);
+    double dy = extent(1);
+    double dz = extent(2);
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  // Slab test, invD holds the reciprocal of the ray direction.
+  // Returns whether the ray enters the box in [0, tmax], tnear is set to the
+  // distance at which it does.
+  bool intersect(Ray const &ray, Vector const &invD, double tmax,
+                 double &tnear) const {
+    double tfar;
+    return intersect(ray, invD, tmax, tnear, tfar);
+  }
+
+  // As above, tfar is set to the distance at which the ray leaves the box
+  bool intersect(Ray const &ray, Vector const &invD, double tmax,
+                 double &tnear, double &tfar) const {
+    double t0 = 0.0;
+    double t1 = tmax;
+    for (int axis = 0; axis != 3; ++axis) {
+      double tA = (min.data[axis] - ray.O.data[axis]) * invD.data[axis];
+      double tB = (max.data[axis] - ray.O.data[axis]) * invD.data[axis];
+      if (tA > tB)
+        std::swap(tA, tB);
+      // written such that NaN's (0 * inf) do not reject the box
+      t0 = tA > t0 ? tA : t0;
+      t1 = tB < t1 ? tB : t1;
+      if (t0 > t1)
+        return false;
+    }
+    tnear = t0;
+    tfar = t1;
+    return true;
+  }
+};
+
+#endif
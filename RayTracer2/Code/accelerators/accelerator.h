@@ -0,0 +1,44 @@
+#ifndef ACCELERATOR_H_
+#define ACCELERATOR_H_
+
+#include "../hit.h"
+#include "../object.h"
+#include "../ray.h"
+
+#include <memory>
+#include <vector>
+
+class Accelerator;
+typedef std::unique_ptr<Accelerator> AcceleratorPtr;
+
+// Structure used by the scene to find the objects hit by a ray. Only objects
+// with finite bounds are handed to an accelerator.
+class Accelerator {
+public:
+  virtual ~Accelerator() = default;
+
+  virtual void build(std::vector<ObjectPtr> const &objects) = 0;
+
+  // Closest hit within the interval of the ray. Each hit found lowers
+  // ray.tmax to its distance. Returns the object hit (and updates hit),
+  // nullptr if nothing was hit within the interval.
+  virtual ObjectPtr intersect(Ray &ray, Hit &hit) = 0;
+
+  // The closest hits of count coherent rays (a packet), like intersect() on
+  // each of them: objs[idx] and hits[idx] are replaced when rays[idx] hits an
+  // object. The default traces the rays one by one.
+  virtual void intersectPacket(Ray *rays, Hit *hits, ObjectPtr *objs,
+                               unsigned count) {
+    for (unsigned idx = 0; idx != count; ++idx) {
+      ObjectPtr obj = intersect(rays[idx], hits[idx]);
+      if (obj)
+        objs[idx] = obj;
+    }
+  }
+
+  // Any object hit within the interval of the ray, the search stops at the
+  // first one found. Returns nullptr if the ray is not blocked.
+  virtual Object *occluder(Ray const &ray) = 0;
+};
+
+#endif
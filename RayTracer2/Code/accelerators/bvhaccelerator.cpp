@@ -0,0 +1,146 @@
+#include "bvhaccelerator.h"
+
+#include "../shapes/sphere.h"
+
+#include <iostream>
+
+using namespace std;
+
+void BVHAccelerator::build(vector<ObjectPtr> const &objects) {
+  this->objects = objects;
+
+  vector<AABB> bounds;
+  bounds.reserve(objects.size());
+  for (auto const &obj : objects)
+    bounds.push_back(obj->boundingBox());
+
+  bvh.build(bounds);
+  spheres.build(objects, bvh.indexData(), bvh.numIndices());
+  cout << "Built BVH with " << bvh.numNodes() << " nodes ("
+       << bvh.memoryUsage() / 1024 << " KiB).\n";
+}
+
+ObjectPtr BVHAccelerator::intersect(Ray &ray, Hit &hit) {
+  unsigned nearest = NO_OBJECT;
+  bool sphere = false;
+
+  double tmax = ray.tmax;
+  bvh.intersectLeaves(
+      ray, tmax, [&](unsigned const *indices, unsigned count, double &tmax) {
+        unsigned idx = intersectLeaf(ray, indices, count, hit, sphere);
+        if (idx != NO_OBJECT) {
+          tmax = ray.tmax;
+          nearest = idx;
+        }
+      });
+
+  if (nearest == NO_OBJECT)
+    return nullptr;
+  if (sphere)
+    hit = Hit(ray.tmax, static_cast<Sphere const &>(*objects[nearest])
+                            .normal(ray, ray.tmax));
+  return objects[nearest];
+}
+
+// Walks the hierarchy with up to BVH4::MAX_PACKET_SIZE rays at a time
+void BVHAccelerator::intersectPacket(Ray *rays, Hit *hits, ObjectPtr *objs,
+                                     unsigned count) {
+  for (unsigned first = 0; first < count; first += BVH4::MAX_PACKET_SIZE) {
+    unsigned size = count - first;
+    if (size > BVH4::MAX_PACKET_SIZE)
+      size = BVH4::MAX_PACKET_SIZE;
+    double tmax[BVH4::MAX_PACKET_SIZE];
+    unsigned nearest[BVH4::MAX_PACKET_SIZE];
+    bool sphere[BVH4::MAX_PACKET_SIZE];
+    for (unsigned lane = 0; lane != size; ++lane) {
+      tmax[lane] = rays[first + lane].tmax;
+      nearest[lane] = NO_OBJECT;
+      sphere[lane] = false;
+    }
+
+    bvh.intersectLeaves(
+        rays + first, tmax, size,
+        [&](unsigned const *indices, unsigned count, unsigned lane) {
+          Ray &ray = rays[first + lane];
+          unsigned idx = intersectLeaf(ray, indices, count,
+                                       hits[first + lane], sphere[lane]);
+          if (idx != NO_OBJECT) {
+            tmax[lane] = ray.tmax;
+            nearest[lane] = idx;
+          }
+        });
+
+    for (unsigned lane = 0; lane != size; ++lane) {
+      if (nearest[lane] == NO_OBJECT)
+        continue;
+      Ray const &ray = rays[first + lane];
+      objs[first + lane] = objects[nearest[lane]];
+      if (sphere[lane])
+        hits[first + lane] =
+            Hit(ray.tmax, static_cast<Sphere const &>(*objects[nearest[lane]])
+                              .normal(ray, ray.tmax));
+    }
+  }
+}
+
+Object *BVHAccelerator::occluder(Ray const &ray) {
+  Object *occluder = nullptr;
+  bvh.occludedLeaves(
+      ray, ray.tmax, [&](unsigned const *indices, unsigned count) {
+        size_t first = indices - bvh.indexData();
+        for (unsigned group = 0; group < count; group += 4) {
+          unsigned lanes = count - group < 4 ? count - group : 4;
+          unsigned mask = spheres.any(first + group, lanes)
+                              ? spheres.occluded(ray, first + group, lanes)
+                              : 0;
+          for (unsigned lane = 0; lane != lanes; ++lane) {
+            unsigned idx = indices[group + lane];
+            bool blocked = spheres.isSphere(first + group + lane)
+                               ? (mask & (1u << lane)) != 0
+                               : objects[idx]->occluded(ray);
+            if (blocked) {
+              occluder = objects[idx].get();
+              return true;
+            }
+          }
+        }
+        return false;
+      });
+  return occluder;
+}
+
+// The objects are tested in the order of the leaf, four spheres at a time
+unsigned BVHAccelerator::intersectLeaf(Ray &ray, unsigned const *indices,
+                                       unsigned count, Hit &hit,
+                                       bool &sphere) const {
+  unsigned nearest = NO_OBJECT;
+  size_t first = indices - bvh.indexData();
+  for (unsigned group = 0; group < count; group += 4) {
+    unsigned lanes = count - group < 4 ? count - group : 4;
+    double t[4];
+    unsigned mask = spheres.any(first + group, lanes)
+                        ? spheres.intersect(ray, first + group, lanes, t)
+                        : 0;
+    for (unsigned lane = 0; lane != lanes; ++lane) {
+      unsigned idx = indices[group + lane];
+      if (spheres.isSphere(first + group + lane)) {
+        // Checked again, an earlier object of the leaf may be closer
+        if ((mask & (1u << lane)) && ray.contains(t[lane])) {
+          ray.tmax = t[lane];
+          nearest = idx;
+          sphere = true;
+        }
+        continue;
+      }
+
+      Hit objectHit(objects[idx]->intersect(ray));
+      if (ray.contains(objectHit.t)) {
+        ray.tmax = objectHit.t;
+        hit = objectHit;
+        nearest = idx;
+        sphere = false;
+      }
+    }
+  }
+  return nearest;
+}
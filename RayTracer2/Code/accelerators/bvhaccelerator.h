@@ -0,0 +1,33 @@
+#ifndef BVHACCELERATOR_H_
+#define BVHACCELERATOR_H_
+
+#include "../bvh4.h"
+#include "../shapes/spherearray.h"
+#include "accelerator.h"
+
+// The objects placed in a bounding volume hierarchy, see bvh4.h. Spheres are
+// also kept in a SphereArray, such that those in a leaf are tested together
+// and the normal is only computed for the closest hit.
+class BVHAccelerator : public Accelerator {
+public:
+  virtual void build(std::vector<ObjectPtr> const &objects);
+  virtual ObjectPtr intersect(Ray &ray, Hit &hit);
+  virtual void intersectPacket(Ray *rays, Hit *hits, ObjectPtr *objs,
+                               unsigned count);
+  virtual Object *occluder(Ray const &ray);
+
+private:
+  BVH4 bvh;
+  std::vector<ObjectPtr> objects; // objects referenced by the hierarchy
+  SphereArray spheres;            // by position in bvh.indexData()
+
+  // Closest hit with the objects of a leaf within the interval of the ray,
+  // lowering ray.tmax. Returns the index of the object, or NO_OBJECT. When
+  // the object is a sphere, *sphere is set and hit is left alone.
+  unsigned intersectLeaf(Ray &ray, unsigned const *indices, unsigned count,
+                         Hit &hit, bool &sphere) const;
+
+  static unsigned const NO_OBJECT = 0xffffffffu;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "gridaccelerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+namespace {
+// Number of cells along the largest axis per cube root of the object count
+double const GRID_DENSITY = 3.0;
+unsigned const MAX_RESOLUTION = 512;
+} // namespace
+
+void GridAccelerator::build(vector<ObjectPtr> const &objects) {
+  this->objects = objects;
+  cellStart.clear();
+  cellObjects.clear();
+
+  bounds = AABB();
+  vector<AABB> boxes;
+  boxes.reserve(objects.size());
+  for (auto const &obj : objects) {
+    boxes.push_back(obj->boundingBox());
+    bounds.extend(boxes.back());
+  }
+
+  if (objects.empty())
+    return;
+
+  // Pick the resolution such that cells are roughly cubes, and the number of
+  // cells is proportional to the number of objects
+  int longest = bounds.longestAxis();
+  double maxExtent = bounds.extent(longest);
+  double cellsPerUnit = GRID_DENSITY * cbrt(objects.size()) / maxExtent;
+  for (int axis = 0; axis != 3; ++axis) {
+    // Flat scenes still need cells with some thickness
+    if (bounds.extent(axis) < 1e-6 * maxExtent) {
+      bounds.min.data[axis] -= 1e-6 * maxExtent;
+      bounds.max.data[axis] += 1e-6 * maxExtent;
+    }
+    double cells = round(bounds.extent(axis) * cellsPerUnit);
+    resolution[axis] = max(1U, min(MAX_RESOLUTION, unsigned(cells)));
+    cellSize[axis] = bounds.extent(axis) / resolution[axis];
+  }
+
+  unsigned numCells = resolution[0] * resolution[1] * resolution[2];
+
+  // Visit the cells overlapped by each object, first to count, then to fill
+  auto forEachCell = [&](AABB const &box, unsigned obj, bool fill) {
+    unsigned lo[3], hi[3], cell[3];
+    for (int axis = 0; axis != 3; ++axis) {
+      lo[axis] = cellCoordinate(box.min.data[axis], axis);
+      hi[axis] = cellCoordinate(box.max.data[axis], axis);
+    }
+    for (cell[2] = lo[2]; cell[2] <= hi[2]; ++cell[2])
+      for (cell[1] = lo[1]; cell[1] <= hi[1]; ++cell[1])
+        for (cell[0] = lo[0]; cell[0] <= hi[0]; ++cell[0])
+          if (fill)
+            cellObjects[cellStart[cellIndex(cell) + 1]++] = obj;
+          else
+            ++cellStart[cellIndex(cell) + 1];
+  };
+
+  cellStart.assign(numCells + 1, 0);
+  for (unsigned obj = 0; obj != boxes.size(); ++obj)
+    forEachCell(boxes[obj], obj, false);
+
+  // Turn the counts into offsets, shifted by one cell so that filling the
+  // cells moves every offset to its final position
+  unsigned total = 0;
+  for (unsigned cell = 1; cell <= numCells; ++cell) {
+    unsigned count = cellStart[cell];
+    cellStart[cell] = total;
+    total += count;
+  }
+  cellObjects.resize(total);
+
+  for (unsigned obj = 0; obj != boxes.size(); ++obj)
+    forEachCell(boxes[obj], obj, true);
+
+  cout << "Built grid of " << resolution[0] << 'x' << resolution[1] << 'x'
+       << resolution[2] << " cells with " << total << " references.\n";
+}
+
+unsigned GridAccelerator::cellCoordinate(double value, int axis) const {
+  double cell = floor((value - bounds.min.data[axis]) / cellSize[axis]);
+  if (!(cell > 0))
+    return 0;
+  return min(unsigned(cell), resolution[axis] - 1);
+}
+
+template <typename VisitCell>
+void GridAccelerator::walk(Ray const &ray, VisitCell &&visit) const {
+  Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+  double tEnter, tLeave;
+  if (cellStart.empty() ||
+      !bounds.intersect(ray, invD, ray.tmax, tEnter, tLeave))
+    return;
+
+  // Set up the 3D-DDA at the cell where the ray enters the grid
+  Point entry = ray.at(tEnter);
+  unsigned cell[3];
+  int step[3];
+  unsigned out[3];     // coordinate past the last cell in the direction
+  double tNext[3];     // distance to the next cell boundary
+  double tDelta[3];    // distance between boundaries
+  for (int axis = 0; axis != 3; ++axis) {
+    cell[axis] = cellCoordinate(entry.data[axis], axis);
+    double origin = ray.O.data[axis];
+    double minimum = bounds.min.data[axis];
+    if (ray.D.data[axis] > 0) {
+      step[axis] = 1;
+      out[axis] = resolution[axis];
+      tNext[axis] =
+          (minimum + (cell[axis] + 1) * cellSize[axis] - origin) * invD.data[axis];
+      tDelta[axis] = cellSize[axis] * invD.data[axis];
+    } else if (ray.D.data[axis] < 0) {
+      step[axis] = -1;
+      out[axis] = -1U;
+      tNext[axis] = (minimum + cell[axis] * cellSize[axis] - origin) *
+                    invD.data[axis];
+      tDelta[axis] = -cellSize[axis] * invD.data[axis];
+    } else {
+      step[axis] = 0;
+      out[axis] = -1U;
+      tNext[axis] = numeric_limits<double>::infinity();
+      tDelta[axis] = numeric_limits<double>::infinity();
+    }
+  }
+
+  while (true) {
+    int axis = tNext[0] < tNext[1] ? 0 : 1;
+    axis = tNext[2] < tNext[axis] ? 2 : axis;
+
+    if (visit(cellIndex(cell), min(tNext[axis], tLeave)))
+      return;
+
+    if (tNext[axis] > tLeave)
+      return;
+    cell[axis] += step[axis];
+    if (cell[axis] == out[axis])
+      return;
+    tNext[axis] += tDelta[axis];
+  }
+}
+
+ObjectPtr GridAccelerator::intersect(Ray &ray, Hit &hit) {
+  ObjectPtr obj = nullptr;
+
+  walk(ray, [&](unsigned cell, double tExit) {
+    for (unsigned idx = cellStart[cell]; idx != cellStart[cell + 1]; ++idx) {
+      ObjectPtr const &object = objects[cellObjects[idx]];
+      Hit objectHit(object->intersect(ray));
+      if (ray.contains(objectHit.t)) {
+        ray.tmax = objectHit.t;
+        hit = objectHit;
+        obj = object;
+      }
+    }
+    // A hit inside this cell can't be beaten by objects in later cells
+    return obj && ray.tmax <= tExit;
+  });
+
+  return obj;
+}
+
+Object *GridAccelerator::occluder(Ray const &ray) {
+  Object *occluder = nullptr;
+  walk(ray, [&](unsigned cell, double) {
+    for (unsigned idx = cellStart[cell]; idx != cellStart[cell + 1]; ++idx) {
+      ObjectPtr const &object = objects[cellObjects[idx]];
+      if (object->occluded(ray)) {
+        occluder = object.get();
+        return true;
+      }
+    }
+    return false;
+  });
+  return occluder;
+}
@@ -0,0 +1,38 @@
+#ifndef GRIDACCELERATOR_H_
+#define GRIDACCELERATOR_H_
+
+#include "../aabb.h"
+#include "accelerator.h"
+
+// Uniform grid over the objects, traversed with a 3D-DDA. Suited for scenes
+// with many small objects of similar size that are spread out evenly.
+class GridAccelerator : public Accelerator {
+public:
+  virtual void build(std::vector<ObjectPtr> const &objects);
+  virtual ObjectPtr intersect(Ray &ray, Hit &hit);
+  virtual Object *occluder(Ray const &ray);
+
+private:
+  AABB bounds;
+  unsigned resolution[3]; // number of cells along each axis
+  double cellSize[3];
+
+  // Objects overlapping cell idx are cellObjects[cellStart[idx]] up to
+  // cellObjects[cellStart[idx + 1]]
+  std::vector<unsigned> cellStart;
+  std::vector<unsigned> cellObjects;
+  std::vector<ObjectPtr> objects;
+
+  unsigned cellIndex(unsigned const cell[3]) const {
+    return (cell[2] * resolution[1] + cell[1]) * resolution[0] + cell[0];
+  }
+
+  unsigned cellCoordinate(double value, int axis) const;
+
+  // Calls visit(cell, tExit) for every cell along the ray in order, until it
+  // returns true. tExit is the distance at which the ray leaves the cell.
+  template <typename VisitCell>
+  void walk(Ray const &ray, VisitCell &&visit) const;
+};
+
+#endif
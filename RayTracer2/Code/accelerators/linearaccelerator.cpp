@@ -0,0 +1,27 @@
+#include "linearaccelerator.h"
+
+using namespace std;
+
+void LinearAccelerator::build(vector<ObjectPtr> const &objects) {
+  this->objects = objects;
+}
+
+ObjectPtr LinearAccelerator::intersect(Ray &ray, Hit &hit) {
+  ObjectPtr obj = nullptr;
+  for (auto const &object : objects) {
+    Hit objectHit(object->intersect(ray));
+    if (ray.contains(objectHit.t)) {
+      ray.tmax = objectHit.t;
+      hit = objectHit;
+      obj = object;
+    }
+  }
+  return obj;
+}
+
+Object *LinearAccelerator::occluder(Ray const &ray) {
+  for (auto const &object : objects)
+    if (object->occluded(ray))
+      return object.get();
+  return nullptr;
+}
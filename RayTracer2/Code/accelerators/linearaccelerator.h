@@ -0,0 +1,17 @@
+#ifndef LINEARACCELERATOR_H_
+#define LINEARACCELERATOR_H_
+
+#include "accelerator.h"
+
+// No acceleration at all: every ray is tested against every object
+class LinearAccelerator : public Accelerator {
+public:
+  virtual void build(std::vector<ObjectPtr> const &objects);
+  virtual ObjectPtr intersect(Ray &ray, Hit &hit);
+  virtual Object *occluder(Ray const &ray);
+
+private:
+  std::vector<ObjectPtr> objects;
+};
+
+#endif
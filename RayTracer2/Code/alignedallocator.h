@@ -0,0 +1,40 @@
+#ifndef ALIGNEDALLOCATOR_H_
+#define ALIGNEDALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Allocator for std::vector which aligns the storage, e.g. to cache lines
+template <typename T, size_t Alignment> class AlignedAllocator {
+public:
+  typedef T value_type;
+
+  template <typename U> struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(AlignedAllocator<U, Alignment> const &) {}
+
+  T *allocate(size_t count) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, Alignment, count * sizeof(T)) != 0)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, size_t) { free(ptr); }
+
+  template <typename U>
+  bool operator==(AlignedAllocator<U, Alignment> const &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(AlignedAllocator<U, Alignment> const &) const {
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "binaryscene.h"
+
+#include "json/json.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+char const MAGIC[8] = "BSCENE\0";
+
+uint64_t align(uint64_t offset) { return (offset + 15) / 16 * 16; }
+} // namespace
+
+void BinaryScene::Header::layout(uint64_t stringsSize) {
+  memcpy(magic, MAGIC, 8);
+  version = VERSION;
+  headerSize = sizeof(Header);
+  lightsOffset = align(headerSize);
+  materialsOffset = align(lightsOffset + numLights * sizeof(Light));
+  objectsOffset = align(materialsOffset + numMaterials * sizeof(Material));
+  stringsOffset = align(objectsOffset + numObjects * sizeof(Object));
+  fileSize = stringsOffset + numStrings * sizeof(uint64_t) + stringsSize;
+}
+
+bool BinaryScene::matches(string const &filename) {
+  char magic[8];
+  ifstream file(filename, ios::binary);
+  return file.read(magic, 8) && memcmp(magic, MAGIC, 8) == 0;
+}
+
+BinaryScene::BinaryScene(string const &filename) : d_file(filename) {
+  auto invalid = [&]() {
+    return runtime_error("Invalid binary scene " + filename + ".");
+  };
+
+  if (d_file.size() < sizeof(Header))
+    throw invalid();
+  d_header = reinterpret_cast<Header const *>(d_file.data());
+  Header const &header = *d_header;
+
+  // The counts are checked against the size before computing the layout
+  // from them, which could overflow otherwise
+  Header expected = header;
+  if (header.numLights > d_file.size() / sizeof(Light) ||
+      header.numMaterials > d_file.size() / sizeof(Material) ||
+      header.numObjects > d_file.size() / sizeof(Object) ||
+      header.numStrings > d_file.size() / sizeof(uint64_t) ||
+      header.fileSize != d_file.size() ||
+      header.fileSize < header.stringsOffset)
+    throw invalid();
+  expected.layout(header.fileSize - header.stringsOffset -
+                  header.numStrings * sizeof(uint64_t));
+  if (memcmp(&header, &expected, sizeof(Header)) != 0 ||
+      (header.settings & ~Header::ALL_SETTINGS) != 0)
+    throw invalid();
+
+  d_lights =
+      reinterpret_cast<Light const *>(d_file.data() + header.lightsOffset);
+  d_materials = reinterpret_cast<Material const *>(d_file.data() +
+                                                   header.materialsOffset);
+  d_objects =
+      reinterpret_cast<Object const *>(d_file.data() + header.objectsOffset);
+  d_strings =
+      reinterpret_cast<uint64_t const *>(d_file.data() + header.stringsOffset);
+
+  // Every string referred to must be in the file
+  for (size_t idx = 0; idx != header.numStrings; ++idx) {
+    uint64_t offset = d_strings[idx];
+    if (offset >= d_file.size() ||
+        memchr(d_file.data() + offset, 0, d_file.size() - offset) == nullptr)
+      throw invalid();
+  }
+
+  if (!validString(header.textureFilter,
+                   !(header.settings & Header::TEXTURE_FILTER)) ||
+      !validString(header.accelerator,
+                   !(header.settings & Header::ACCELERATOR)) ||
+      !validString(header.meshCacheDirectory,
+                   !(header.settings & Header::MESH_CACHE_DIRECTORY)) ||
+      !validString(header.textureCacheDirectory,
+                   !(header.settings & Header::TEXTURE_CACHE_DIRECTORY)))
+    throw invalid();
+
+  for (size_t idx = 0; idx != header.numMaterials; ++idx)
+    if (!validString(d_materials[idx].texture, true))
+      throw invalid();
+
+  for (size_t idx = 0; idx != header.numObjects; ++idx) {
+    Object const &object = d_objects[idx];
+    if (object.type > CYLINDER || object.material >= header.numMaterials ||
+        !validString(object.model, object.type != MESH) ||
+        (object.flags & ~ROTATED) != 0)
+      throw invalid();
+  }
+}
+
+char const *BinaryScene::text(uint32_t idx) const {
+  return d_file.data() + d_strings[idx];
+}
+
+json BinaryScene::settings() const {
+  Header const &header = *d_header;
+  json settings = json::object();
+  settings["Eye"] = {header.eye[0], header.eye[1], header.eye[2]};
+  if (header.settings & Header::SHADOWS)
+    settings["Shadows"] = header.shadows != 0;
+  if (header.settings & Header::SUPER_SAMPLING_FACTOR)
+    settings["SuperSamplingFactor"] = header.superSamplingFactor;
+  if (header.settings & Header::MAX_RECURSION_DEPTH)
+    settings["MaxRecursionDepth"] = header.maxRecursionDepth;
+  if (header.settings & Header::PACKET_SIZE)
+    settings["PacketSize"] = header.packetSize;
+  if (header.settings & Header::WAVEFRONT)
+    settings["Wavefront"] = header.wavefront != 0;
+  if (header.settings & Header::TEXTURE_FILTER)
+    settings["TextureFilter"] = text(header.textureFilter);
+  if (header.settings & Header::ACCELERATOR)
+    settings["Accelerator"] = text(header.accelerator);
+  if (header.settings & Header::MESH_CACHE)
+    settings["MeshCache"] = header.meshCache != 0;
+  if (header.settings & Header::MESH_CACHE_DIRECTORY)
+    settings["MeshCacheDirectory"] = text(header.meshCacheDirectory);
+  if (header.settings & Header::TEXTURE_CACHE)
+    settings["TextureCache"] = header.textureCache != 0;
+  if (header.settings & Header::TEXTURE_CACHE_DIRECTORY)
+    settings["TextureCacheDirectory"] = text(header.textureCacheDirectory);
+  if (header.settings & Header::TEXTURE_MEMORY)
+    settings["TextureMemory"] = header.textureMemory;
+  return settings;
+}
+
+bool BinaryScene::validString(uint32_t idx, bool optional) const {
+  return idx < d_header->numStrings || (optional && idx == NONE);
+}
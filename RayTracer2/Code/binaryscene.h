@@ -0,0 +1,136 @@
+#ifndef BINARYSCENE_H_
+#define BINARYSCENE_H_
+
+#include "mappedfile.h"
+
+#include "json/json_fwd.h"
+
+#include <cstdint>
+#include <string>
+
+// The binary scene format (.bscene): a .json scene file converted once (see
+// Tools/sceneconvert.cpp), which the raytracer maps and reads into the scene
+// directly instead of parsing text. The file is a header holding the eye and
+// the settings, followed by arrays of fixed size records, each aligned to 16
+// bytes: the lights, the materials, the objects, and the offsets of the
+// strings (models, textures and settings) which the records refer to by
+// index, followed by the strings themselves. Values are stored little
+// endian.
+class BinaryScene {
+public:
+  enum : uint32_t { NONE = 0xffffffff }; // index of no string
+
+  struct Header {
+    enum : uint32_t { VERSION = 2 };
+
+    // The settings given in the scene, the others keep their defaults
+    enum Settings : uint32_t {
+      SHADOWS = 1 << 0,
+      SUPER_SAMPLING_FACTOR = 1 << 1,
+      MAX_RECURSION_DEPTH = 1 << 2,
+      PACKET_SIZE = 1 << 3,
+      WAVEFRONT = 1 << 4,
+      TEXTURE_FILTER = 1 << 5,
+      ACCELERATOR = 1 << 6,
+      MESH_CACHE = 1 << 7,
+      MESH_CACHE_DIRECTORY = 1 << 8,
+      TEXTURE_CACHE = 1 << 9,
+      TEXTURE_CACHE_DIRECTORY = 1 << 10,
+      TEXTURE_MEMORY = 1 << 11,
+      ALL_SETTINGS = (1 << 12) - 1
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t settings;
+    uint32_t shadows; // 0 or 1, as the other flags
+    uint32_t superSamplingFactor;
+    uint32_t maxRecursionDepth;
+    uint32_t packetSize;
+    uint32_t wavefront;
+    uint32_t meshCache;
+    uint32_t textureCache;
+    uint32_t textureFilter; // string, as in the .json file
+    uint32_t accelerator;   // string, as in the .json file
+    uint32_t meshCacheDirectory;    // string
+    uint32_t textureCacheDirectory; // string
+    uint32_t numLights;
+    uint32_t padding;
+    uint64_t textureMemory; // MiB
+    double eye[3];
+    uint64_t numMaterials;
+    uint64_t numObjects;
+    uint64_t numStrings;
+    uint64_t lightsOffset;
+    uint64_t materialsOffset;
+    uint64_t objectsOffset;
+    uint64_t stringsOffset; // numStrings offsets of NUL terminated strings
+    uint64_t fileSize;      // the strings end here
+
+    // Sets the magic, the version and the offsets of the arrays from the
+    // counts. The strings, of size bytes in total, come last.
+    void layout(uint64_t stringsSize);
+  };
+
+  struct Light {
+    double position[3];
+    double color[3];
+  };
+
+  struct Material {
+    double color[3]; // unused with a texture
+    double ka;
+    double kd;
+    double ks;
+    double n;
+    uint32_t texture; // string, NONE for a color
+    uint32_t padding;
+  };
+
+  enum Type : uint32_t { SPHERE, TRIANGLE, MESH, PLANE, CYLINDER };
+  enum Flags : uint32_t { ROTATED = 1 }; // spheres and meshes only
+
+  // The values of an object by type, in the order of the .json file:
+  // SPHERE   position (3), radius, rotation (3), angle
+  // TRIANGLE vertices (3 x 3)
+  // MESH     position (3), scale, rotation (3), angle
+  // PLANE    point (3), normal (3)
+  // CYLINDER pointA (3), pointB (3), radius
+  struct Object {
+    uint32_t type;
+    uint32_t material; // index into the materials
+    uint32_t model;    // string, the model file of a mesh, else NONE
+    uint32_t flags;
+    double values[9];
+  };
+
+  // Whether the file starts like a binary scene
+  static bool matches(std::string const &filename);
+
+  // Maps the file and checks the header and all records, throws if the file
+  // is not a valid binary scene
+  explicit BinaryScene(std::string const &filename);
+
+  Header const &header() const { return *d_header; }
+  Light const *lights() const { return d_lights; }
+  Material const *materials() const { return d_materials; }
+  Object const *objects() const { return d_objects; }
+  char const *text(uint32_t idx) const; // string idx
+  size_t size() const { return d_file.size(); }
+
+  // The eye and the settings given as in a .json scene file
+  nlohmann::json settings() const;
+
+private:
+  MappedFile d_file;
+  Header const *d_header;
+  Light const *d_lights;
+  Material const *d_materials;
+  Object const *d_objects;
+  uint64_t const *d_strings;
+
+  bool validString(uint32_t idx, bool optional) const;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <omp.h>
+
+using namespace std;
+
+namespace {
+// Number of buckets the centroids are sorted into when evaluating splits
+unsigned const NUM_BINS = 16;
+// Leaves are never larger than this, unless primitives can't be separated
+unsigned const MAX_LEAF_SIZE = 4;
+// Relative costs of visiting a node and of intersecting a primitive
+double const TRAVERSAL_COST = 1.0;
+double const INTERSECTION_COST = 1.0;
+// Ranges with fewer primitives are built by a single task
+unsigned const PARALLEL_THRESHOLD = 4096;
+// Large ranges are bounded and binned in chunks of this size, in parallel
+unsigned const CHUNK_SIZE = 16384;
+
+struct Bin {
+  AABB box;
+  unsigned count = 0;
+};
+
+struct Bins {
+  Bin bin[NUM_BINS];
+};
+
+// Calls accumulate(first, last, result) for chunks of [begin, end) in separate
+// tasks and combines the results of the chunks with merge(result, chunk).
+template <typename Result, typename Accumulate, typename Merge>
+Result reduceChunks(unsigned begin, unsigned end, Accumulate accumulate,
+                    Merge merge) {
+  Result result;
+  if (end - begin < 2 * CHUNK_SIZE) {
+    accumulate(begin, end, result);
+    return result;
+  }
+
+  unsigned numChunks = (end - begin + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  vector<Result> chunks(numChunks);
+  for (unsigned chunk = 0; chunk != numChunks; ++chunk) {
+    unsigned first = begin + chunk * CHUNK_SIZE;
+    unsigned last = min(end, first + CHUNK_SIZE);
+#pragma omp task shared(chunks, accumulate)
+    accumulate(first, last, chunks[chunk]);
+  }
+#pragma omp taskwait
+
+  for (Result const &chunk : chunks)
+    merge(result, chunk);
+  return result;
+}
+
+// Appends a subtree that was built on its own, returns the index of its root
+unsigned appendSubtree(vector<BVH::Node> &nodes,
+                       vector<BVH::Node> const &subtree) {
+  unsigned root = nodes.size();
+  for (BVH::Node node : subtree) {
+    if (node.count == 0)
+      node.offset += root;
+    nodes.push_back(node);
+  }
+  return root;
+}
+} // namespace
+
+void BVH::build(vector<AABB> const &bounds) {
+  d_nodes.clear();
+  d_indices.resize(bounds.size());
+  iota(d_indices.begin(), d_indices.end(), 0U);
+
+  if (bounds.empty())
+    return;
+
+  vector<Point> centroids;
+  centroids.reserve(bounds.size());
+  for (AABB const &box : bounds)
+    centroids.push_back(Point(box.center(0), box.center(1), box.center(2)));
+
+  d_nodes.reserve(2 * bounds.size());
+
+  // Subtrees are built in tasks. When we are already part of a team (several
+  // meshes being loaded at once) the tasks are shared with that team.
+  if (omp_in_parallel()) {
+    buildNode(bounds, centroids, d_nodes, 0, bounds.size(), 0);
+  } else {
+#pragma omp parallel
+#pragma omp single
+    buildNode(bounds, centroids, d_nodes, 0, bounds.size(), 0);
+  }
+}
+
+unsigned BVH::buildNode(vector<AABB> const &bounds,
+                        vector<Point> const &centroids, vector<Node> &nodes,
+                        unsigned begin, unsigned end, unsigned depth) {
+  unsigned nodeIdx = nodes.size();
+  nodes.push_back(Node{AABB(), begin, end - begin});
+
+  // Bounds of the primitives and of their centroids
+  struct Boxes {
+    AABB box;
+    AABB centroidBox;
+  };
+  Boxes boxes = reduceChunks<Boxes>(
+      begin, end,
+      [&](unsigned first, unsigned last, Boxes &result) {
+        for (unsigned idx = first; idx != last; ++idx) {
+          result.box.extend(bounds[d_indices[idx]]);
+          result.centroidBox.extend(centroids[d_indices[idx]]);
+        }
+      },
+      [](Boxes &result, Boxes const &chunk) {
+        result.box.extend(chunk.box);
+        result.centroidBox.extend(chunk.centroidBox);
+      });
+  AABB const &box = boxes.box;
+  AABB const &centroidBox = boxes.centroidBox;
+  nodes[nodeIdx].bounds = box;
+
+  unsigned count = end - begin;
+  int axis = centroidBox.longestAxis();
+  double extent = centroidBox.extent(axis);
+
+  // Nothing to split (see MAX_DEPTH)
+  if (count == 1 || depth + 2 >= MAX_DEPTH)
+    return nodeIdx;
+
+  // Centroids in one point can't be binned, split them in halves
+  if (!(extent > 0.0)) {
+    if (count <= MAX_LEAF_SIZE)
+      return nodeIdx;
+    return splitNode(bounds, centroids, nodes, nodeIdx, begin,
+                     begin + count / 2, end, depth);
+  }
+
+  // Sort the primitives into bins along the axis by their centroid
+
+  double origin = centroidBox.min.data[axis];
+  double scale = NUM_BINS / extent;
+  auto binOf = [&](unsigned prim) {
+    unsigned bin = (centroids[prim].data[axis] - origin) * scale;
+    return min(bin, NUM_BINS - 1);
+  };
+
+  Bins binned = reduceChunks<Bins>(
+      begin, end,
+      [&](unsigned first, unsigned last, Bins &result) {
+        for (unsigned idx = first; idx != last; ++idx) {
+          Bin &bin = result.bin[binOf(d_indices[idx])];
+          bin.box.extend(bounds[d_indices[idx]]);
+          ++bin.count;
+        }
+      },
+      [](Bins &result, Bins const &chunk) {
+        for (unsigned bin = 0; bin != NUM_BINS; ++bin) {
+          result.bin[bin].box.extend(chunk.bin[bin].box);
+          result.bin[bin].count += chunk.bin[bin].count;
+        }
+      });
+  Bin const *bins = binned.bin;
+
+  // Sweep from the right to get the cost of each right hand side
+  double rightArea[NUM_BINS];
+  unsigned rightCount[NUM_BINS];
+  AABB accumulated;
+  unsigned accumulatedCount = 0;
+  for (unsigned bin = NUM_BINS - 1; bin != 0; --bin) {
+    accumulated.extend(bins[bin].box);
+    accumulatedCount += bins[bin].count;
+    rightArea[bin] = accumulated.surfaceArea();
+    rightCount[bin] = accumulatedCount;
+  }
+
+  // Sweep from the left to find the cheapest split
+  accumulated = AABB();
+  accumulatedCount = 0;
+  unsigned split = 0;
+  double bestCost = numeric_limits<double>::infinity();
+  for (unsigned bin = 0; bin != NUM_BINS - 1; ++bin) {
+    accumulated.extend(bins[bin].box);
+    accumulatedCount += bins[bin].count;
+    double cost = accumulatedCount * accumulated.surfaceArea() +
+                  rightCount[bin + 1] * rightArea[bin + 1];
+    if (cost < bestCost) {
+      bestCost = cost;
+      split = bin + 1;
+    }
+  }
+
+  // SAH: keep a small leaf if splitting it does not pay off
+  double leafCost = INTERSECTION_COST * count;
+  double splitCost =
+      TRAVERSAL_COST + INTERSECTION_COST * bestCost / box.surfaceArea();
+  if (count <= MAX_LEAF_SIZE && leafCost <= splitCost)
+    return nodeIdx;
+
+  unsigned middle =
+      partition(d_indices.begin() + begin, d_indices.begin() + end,
+                [&](unsigned prim) { return binOf(prim) < split; }) -
+      d_indices.begin();
+
+  // All centroids ended up at one side, fall back on a median split
+  if (middle == begin || middle == end) {
+    middle = begin + count / 2;
+    nth_element(d_indices.begin() + begin, d_indices.begin() + middle,
+                d_indices.begin() + end, [&](unsigned lhs, unsigned rhs) {
+                  return centroids[lhs].data[axis] < centroids[rhs].data[axis];
+                });
+  }
+
+  return splitNode(bounds, centroids, nodes, nodeIdx, begin, middle, end,
+                   depth);
+}
+
+unsigned BVH::splitNode(vector<AABB> const &bounds,
+                        vector<Point> const &centroids, vector<Node> &nodes,
+                        unsigned nodeIdx, unsigned begin, unsigned middle,
+                        unsigned end, unsigned depth) {
+  unsigned right;
+  if (end - begin < PARALLEL_THRESHOLD) {
+    buildNode(bounds, centroids, nodes, begin, middle, depth + 1);
+    right = buildNode(bounds, centroids, nodes, middle, end, depth + 1);
+  } else {
+    // The halves own disjoint ranges of d_indices, so they can be built at
+    // the same time into separate arrays. Appending them afterwards gives the
+    // same layout as building them one after the other.
+    vector<Node> leftNodes;
+    vector<Node> rightNodes;
+#pragma omp task shared(bounds, centroids, leftNodes)
+    buildNode(bounds, centroids, leftNodes, begin, middle, depth + 1);
+    buildNode(bounds, centroids, rightNodes, middle, end, depth + 1);
+#pragma omp taskwait
+
+    appendSubtree(nodes, leftNodes);
+    right = appendSubtree(nodes, rightNodes);
+  }
+
+  nodes[nodeIdx].offset = right;
+  nodes[nodeIdx].count = 0;
+  return nodeIdx;
+}
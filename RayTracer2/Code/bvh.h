@@ -0,0 +1,51 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "aabb.h"
+
+#include <vector>
+
+// Builder of a binary bounding volume hierarchy over a set of primitives,
+// using the surface area heuristic (SAH). The hierarchy only knows the
+// bounds of the primitives, its leaves refer to them by their index in the
+// vector passed to build(). It is not traversed itself: BVH4 collapses it
+// into a four-wide hierarchy for tracing.
+class BVH {
+public:
+  struct Node {
+    AABB bounds;
+    unsigned offset; // leaf: first slot in d_indices, interior: right child
+    unsigned count;  // number of primitives in a leaf, 0 for interior nodes
+  };
+
+  void build(std::vector<AABB> const &bounds);
+
+  std::vector<Node> const &nodes() const { return d_nodes; }
+  std::vector<unsigned> const &indices() const { return d_indices; }
+
+  bool empty() const { return d_nodes.empty(); }
+  AABB bounds() const { return empty() ? AABB() : d_nodes[0].bounds; }
+  size_t numNodes() const { return d_nodes.size(); }
+
+private:
+  std::vector<Node> d_nodes;      // depth first, left child follows parent
+  std::vector<unsigned> d_indices; // primitive indices referenced by leaves
+
+  // Deepest level of a node, which bounds the depth of the BVH4 collapsed
+  // from it and so the stack its traversal needs
+  static unsigned const MAX_DEPTH = 64;
+
+  // Both append the subtree over d_indices[begin, end) to nodes and return
+  // the index of its root. Large subtrees are built in OpenMP tasks.
+  unsigned buildNode(std::vector<AABB> const &bounds,
+                     std::vector<Point> const &centroids,
+                     std::vector<Node> &nodes, unsigned begin, unsigned end,
+                     unsigned depth);
+  unsigned splitNode(std::vector<AABB> const &bounds,
+                     std::vector<Point> const &centroids,
+                     std::vector<Node> &nodes, unsigned nodeIdx,
+                     unsigned begin, unsigned middle, unsigned end,
+                     unsigned depth);
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "bvh4.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+// Quantization to 8 bits, the bounds of a child are rounded outwards to the
+// next step and then moved one more step to cover single precision rounding
+// of the ray in intersectChildren
+double const STEPS = 255.0;
+
+uint8_t quantizeLower(double value, float origin, float scale) {
+  if (!(scale > 0.0f))
+    return 0;
+  double step = floor((value - origin) / scale) - 1.0;
+  return static_cast<uint8_t>(max(0.0, min(STEPS, step)));
+}
+
+uint8_t quantizeUpper(double value, float origin, float scale) {
+  if (!(scale > 0.0f))
+    return static_cast<uint8_t>(STEPS);
+  double step = ceil((value - origin) / scale) + 1.0;
+  return static_cast<uint8_t>(max(0.0, min(STEPS, step)));
+}
+
+// Largest float not above value
+float floatBelow(double value) {
+  float result = static_cast<float>(value);
+  if (result > value)
+    result = nextafter(result, -numeric_limits<float>::infinity());
+  return result;
+}
+
+// Smallest float not below value
+float floatAbove(double value) {
+  float result = static_cast<float>(value);
+  if (result < value)
+    result = nextafter(result, numeric_limits<float>::infinity());
+  return result;
+}
+} // namespace
+
+void BVH4::build(vector<AABB> const &bounds) {
+  BVH bvh;
+  bvh.build(bounds);
+
+  // Nodes and indices stored in vectors owned by the hierarchy
+  struct Storage {
+    NodeVector nodes;
+    vector<unsigned> indices;
+  };
+  shared_ptr<Storage> storage(new Storage());
+  if (!bvh.empty()) {
+    storage->indices = bvh.indices();
+    storage->nodes.reserve(bvh.numNodes() / 2 + 1);
+    collapse(bvh, bounds, 0, storage->nodes);
+  }
+
+  assign(storage->nodes.data(), storage->nodes.size(),
+         storage->indices.data(), storage->indices.size(), bvh.bounds(),
+         storage);
+}
+
+void BVH4::assign(Node const *nodes, size_t numNodes, unsigned const *indices,
+                  size_t numIndices, AABB const &bounds,
+                  shared_ptr<void const> const &storage) {
+  d_nodes = nodes;
+  d_numNodes = numNodes;
+  d_indices = indices;
+  d_numIndices = numIndices;
+  d_bounds = bounds;
+  d_storage = storage;
+}
+
+bool BVH4::valid(size_t numPrimitives) const {
+  for (size_t idx = 0; idx != d_numIndices; ++idx)
+    if (d_indices[idx] >= numPrimitives)
+      return false;
+
+  // Children are stored after their parent (see collapse), so a pass in
+  // order sees every parent before its children and can not loop
+  vector<unsigned> depth(d_numNodes, 0);
+  for (size_t nodeIdx = 0; nodeIdx != d_numNodes; ++nodeIdx) {
+    // A node at depth d is entered with at most 3 d siblings of its
+    // ancestors on the stack, and pushes at most 4 more
+    if (3 * depth[nodeIdx] + 4 > STACK_SIZE)
+      return false;
+
+    for (uint32_t child : d_nodes[nodeIdx].child) {
+      if (child == EMPTY)
+        continue;
+      if (child & LEAF) {
+        size_t offset = child & LEAF_OFFSET_MASK;
+        size_t count = ((child & ~LEAF) >> LEAF_COUNT_SHIFT) + 1;
+        if (offset + count > d_numIndices)
+          return false;
+      } else {
+        if (child <= nodeIdx || child >= d_numNodes)
+          return false;
+        depth[child] = max(depth[child], depth[nodeIdx] + 1);
+      }
+    }
+  }
+  return true;
+}
+
+size_t BVH4::memoryUsage() const {
+  return d_numNodes * sizeof(Node) + d_numIndices * sizeof(unsigned);
+}
+
+// A node over box with the boxes of its numChildren children quantized, the
+// children themselves are left EMPTY
+BVH4::Node BVH4::makeNode(AABB const &box, AABB const *childBoxes,
+                          unsigned numChildren) {
+  Node node;
+  for (int axis = 0; axis != 3; ++axis) {
+    node.origin[axis] = floatBelow(box.min.data[axis]);
+    // Slightly more than the extent over the steps, to surely reach the top
+    node.scale[axis] =
+        floatAbove((box.max.data[axis] - node.origin[axis]) / STEPS * 1.000001);
+  }
+
+  for (unsigned idx = 0; idx != 4; ++idx) {
+    node.child[idx] = EMPTY;
+    for (int axis = 0; axis != 3; ++axis) {
+      if (idx >= numChildren) {
+        node.lower[axis][idx] = 0;
+        node.upper[axis][idx] = 0;
+        continue;
+      }
+      node.lower[axis][idx] = quantizeLower(childBoxes[idx].min.data[axis],
+                                            node.origin[axis],
+                                            node.scale[axis]);
+      node.upper[axis][idx] = quantizeUpper(childBoxes[idx].max.data[axis],
+                                            node.origin[axis],
+                                            node.scale[axis]);
+    }
+  }
+  return node;
+}
+
+// Turns binary node binaryIdx into a four-wide node by pulling up the
+// children of its largest interior children. Returns the new node's index.
+uint32_t BVH4::collapse(BVH const &bvh, vector<AABB> const &bounds,
+                        unsigned binaryIdx, NodeVector &nodes) {
+  vector<BVH::Node> const &binary = bvh.nodes();
+
+  unsigned children[4];
+  unsigned numChildren = 0;
+  if (binary[binaryIdx].count > 0) { // a leaf as root
+    children[numChildren++] = binaryIdx;
+  } else {
+    children[numChildren++] = binaryIdx + 1;
+    children[numChildren++] = binary[binaryIdx].offset;
+  }
+
+  while (numChildren < 4) {
+    int largest = -1;
+    double largestArea = -1.0;
+    for (unsigned idx = 0; idx != numChildren; ++idx) {
+      BVH::Node const &child = binary[children[idx]];
+      if (child.count == 0 && child.bounds.surfaceArea() > largestArea) {
+        largest = idx;
+        largestArea = child.bounds.surfaceArea();
+      }
+    }
+    if (largest < 0) // only leaves left
+      break;
+
+    unsigned opened = children[largest];
+    children[largest] = opened + 1;
+    children[numChildren++] = binary[opened].offset;
+  }
+
+  uint32_t nodeIdx = nodes.size();
+  nodes.push_back(Node());
+
+  AABB childBoxes[4];
+  for (unsigned idx = 0; idx != numChildren; ++idx)
+    childBoxes[idx] = binary[children[idx]].bounds;
+  Node node = makeNode(binary[binaryIdx].bounds, childBoxes, numChildren);
+
+  for (unsigned idx = 0; idx != numChildren; ++idx) {
+    BVH::Node const &child = binary[children[idx]];
+    if (child.count > 0)
+      node.child[idx] =
+          leaf(bvh.indices(), bounds, child.offset, child.count, nodes);
+    else
+      node.child[idx] = collapse(bvh, bounds, children[idx], nodes);
+  }
+
+  nodes[nodeIdx] = node;
+  return nodeIdx;
+}
+
+// The child referring to the primitives indices[offset, offset + count).
+// The binary hierarchy stops splitting at its depth limit, which may leave
+// more primitives than a leaf holds; those are spread over a subtree of
+// nodes with up to four leaves each.
+uint32_t BVH4::leaf(vector<unsigned> const &indices,
+                    vector<AABB> const &bounds, unsigned offset,
+                    unsigned count, NodeVector &nodes) {
+  if (count <= MAX_LEAF_SIZE) {
+    if (offset > LEAF_OFFSET_MASK)
+      throw runtime_error("BVH4: leaf does not fit in a node.");
+    return LEAF | ((count - 1) << LEAF_COUNT_SHIFT) | offset;
+  }
+
+  // Four parts of the range, each as large as possible to keep the subtree
+  // shallow
+  unsigned partSize = (count + 3) / 4;
+  unsigned parts[5];
+  AABB box, partBoxes[4];
+  unsigned numParts = 0;
+  for (unsigned first = 0; first < count; first += partSize) {
+    parts[numParts] = offset + first;
+    for (unsigned idx = first; idx != min(first + partSize, count); ++idx)
+      partBoxes[numParts].extend(bounds[indices[offset + idx]]);
+    box.extend(partBoxes[numParts]);
+    ++numParts;
+  }
+  parts[numParts] = offset + count;
+
+  uint32_t nodeIdx = nodes.size();
+  nodes.push_back(Node());
+  Node node = makeNode(box, partBoxes, numParts);
+  for (unsigned idx = 0; idx != numParts; ++idx)
+    node.child[idx] = leaf(indices, bounds, parts[idx],
+                           parts[idx + 1] - parts[idx], nodes);
+  nodes[nodeIdx] = node;
+  return nodeIdx;
+}
@@ -0,0 +1,441 @@
+#ifndef BVH4_H_
+#define BVH4_H_
+
+#include "aabb.h"
+#include "alignedallocator.h"
+#include "bvh.h"
+#include "ray.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Four-wide BVH, collapsed from a binary one (see bvh.h). The boxes of the
+// children are stored as 8-bit offsets within the box of their parent, such
+// that a node fits in a single cache line, and the four children of a node
+// are tested against a ray at once.
+class BVH4 {
+public:
+  struct Node {
+    float origin[3];     // lower corner of the node
+    float scale[3];      // size of a quantization step along each axis
+    uint8_t lower[3][4]; // quantized lower bounds of the children per axis
+    uint8_t upper[3][4]; // quantized upper bounds of the children per axis
+    uint32_t child[4];   // node index, leaf (see LEAF) or EMPTY
+  };
+
+  // Leaves are stored in the child of their parent: the LEAF flag, the
+  // number of primitives minus one and the offset into d_indices
+  static uint32_t const LEAF = 0x80000000u;
+  static uint32_t const LEAF_COUNT_SHIFT = 28;
+  static uint32_t const LEAF_OFFSET_MASK = 0x0fffffffu;
+  static uint32_t const EMPTY = 0xffffffffu;
+
+  void build(std::vector<AABB> const &bounds);
+
+  // Use a hierarchy stored elsewhere (e.g. a mapped file), which is kept
+  // alive by storage. nodes must be aligned to 64 bytes.
+  void assign(Node const *nodes, size_t numNodes, unsigned const *indices,
+              size_t numIndices, AABB const &bounds,
+              std::shared_ptr<void const> const &storage);
+
+  // Whether the nodes and indices form a hierarchy over numPrimitives
+  // primitives which the traversal can walk safely: children follow their
+  // parent, leaves lie within the indices, the indices refer to primitives
+  // and the depth fits the traversal stack. Meant for hierarchies assigned
+  // from a file, which may be damaged.
+  bool valid(size_t numPrimitives) const;
+
+  bool empty() const { return d_numNodes == 0; }
+  AABB bounds() const { return d_bounds; }
+  size_t numNodes() const { return d_numNodes; }
+  size_t numIndices() const { return d_numIndices; }
+  Node const *nodeData() const { return d_nodes; }
+  unsigned const *indexData() const { return d_indices; }
+  size_t memoryUsage() const; // bytes used by nodes and indices
+
+  // Closest hit traversal, visiting the leaves the ray enters within
+  // [0, tmax] nearest first. hitLeaf(indices, count, tmax) should intersect
+  // the count primitives indices[0, count) and lower tmax when it finds a
+  // hit closer than tmax; leaves entered beyond the lowered tmax are skipped.
+  template <typename HitLeaf>
+  void intersectLeaves(Ray const &ray, double &tmax, HitLeaf &&hitLeaf) const;
+
+  // Any hit traversal. hitLeaf(indices, count) returns whether one of the
+  // primitives indices[0, count) blocks the ray within tmax, traversal stops
+  // at the first leaf that does.
+  template <typename HitLeaf>
+  bool occludedLeaves(Ray const &ray, double tmax, HitLeaf &&hitLeaf) const;
+
+  // Largest number of rays traced together by the packet traversal
+  static unsigned const MAX_PACKET_SIZE = 16;
+
+  // Closest hit traversal of a packet of count (at most MAX_PACKET_SIZE)
+  // coherent rays. Each node is visited once for all rays entering it, and
+  // the rays are tested against its children four at a time.
+  // hitLeaf(indices, count, lane) should intersect the count primitives
+  // indices[0, count) with rays[lane] and lower tmax[lane] when it finds a
+  // hit closer than tmax[lane].
+  template <typename HitLeaf>
+  void intersectLeaves(Ray const *rays, double *tmax, unsigned count,
+                       HitLeaf &&hitLeaf) const;
+
+private:
+  typedef std::vector<Node, AlignedAllocator<Node, 64>> NodeVector;
+
+  Node const *d_nodes = nullptr;
+  size_t d_numNodes = 0;
+  unsigned const *d_indices = nullptr; // primitive indices used by leaves
+  size_t d_numIndices = 0;
+  AABB d_bounds;
+  std::shared_ptr<void const> d_storage; // owner of nodes and indices
+
+  static unsigned const STACK_SIZE = 256;
+
+  // The ray in single precision, as used by the node test
+  struct FloatRay {
+    float O[3];
+    float invD[3];
+    explicit FloatRay(Ray const &ray);
+  };
+
+  struct Entry {
+    uint32_t child;
+    float tnear;
+  };
+
+  // A packet of rays in single precision, stored per component such that
+  // four lanes (rays) load at once. Unused lanes never enter a box.
+  struct FloatPacket {
+    alignas(16) float O[3][MAX_PACKET_SIZE];
+    alignas(16) float invD[3][MAX_PACKET_SIZE];
+    alignas(16) float tmax[MAX_PACKET_SIZE];
+    FloatPacket(Ray const *rays, double const *tmax, unsigned count);
+  };
+
+  // Node visited by some of the rays of a packet (the active lanes)
+  struct PacketEntry {
+    uint32_t child;
+    uint32_t active;
+    float tnear; // nearest entry of the active lanes
+  };
+
+  // Most primitives in a leaf, as its count is stored in three bits
+  static unsigned const MAX_LEAF_SIZE = 1u << (31 - LEAF_COUNT_SHIFT);
+
+  static Node makeNode(AABB const &box, AABB const *childBoxes,
+                       unsigned numChildren);
+  static uint32_t collapse(BVH const &bvh, std::vector<AABB> const &bounds,
+                           unsigned binaryIdx, NodeVector &nodes);
+  static uint32_t leaf(std::vector<unsigned> const &indices,
+                       std::vector<AABB> const &bounds, unsigned offset,
+                       unsigned count, NodeVector &nodes);
+
+  // Bitmask of the children hit in [0, tmax], tnear receives their entry
+  static unsigned intersectChildren(Node const &node, FloatRay const &ray,
+                                    float tmax, float tnear[4]);
+
+  // For each child the active lanes entering it in [0, tmax], tnear receives
+  // the nearest entry among those lanes
+  static void intersectChildren(Node const &node, FloatPacket const &packet,
+                                uint32_t active, uint32_t masks[4],
+                                float tnear[4]);
+
+  static float toFloat(double tmax);
+};
+
+inline BVH4::FloatRay::FloatRay(Ray const &ray) {
+  for (int axis = 0; axis != 3; ++axis) {
+    O[axis] = ray.O.data[axis];
+    // Keep the reciprocal finite, so 0 * invD never turns into a NaN
+    double inv = 1.0 / ray.D.data[axis];
+    if (!(std::abs(inv) < 1e30))
+      inv = std::signbit(ray.D.data[axis]) ? -1e30 : 1e30;
+    invD[axis] = inv;
+  }
+}
+
+inline BVH4::FloatPacket::FloatPacket(Ray const *rays, double const *tmax,
+                                      unsigned count) {
+  for (unsigned lane = 0; lane != MAX_PACKET_SIZE; ++lane) {
+    if (lane < count) {
+      FloatRay ray(rays[lane]);
+      for (int axis = 0; axis != 3; ++axis) {
+        O[axis][lane] = ray.O[axis];
+        invD[axis][lane] = ray.invD[axis];
+      }
+      this->tmax[lane] = toFloat(tmax[lane]);
+    } else {
+      for (int axis = 0; axis != 3; ++axis) {
+        O[axis][lane] = 0.0f;
+        invD[axis][lane] = 1.0f;
+      }
+      this->tmax[lane] = -1.0f;
+    }
+  }
+}
+
+inline float BVH4::toFloat(double tmax) {
+  return tmax < 3e38 ? static_cast<float>(tmax)
+                     : std::numeric_limits<float>::infinity();
+}
+
+inline unsigned BVH4::intersectChildren(Node const &node, FloatRay const &ray,
+                                        float tmax, float tnear[4]) {
+#ifdef __SSE2__
+  __m128i const zero = _mm_setzero_si128();
+  __m128 t0 = _mm_setzero_ps();
+  __m128 t1 = _mm_set1_ps(tmax);
+  for (int axis = 0; axis != 3; ++axis) {
+    // t = (origin + q * scale - O) * invD = q * a + b
+    __m128 a = _mm_set1_ps(node.scale[axis] * ray.invD[axis]);
+    __m128 b = _mm_set1_ps((node.origin[axis] - ray.O[axis]) * ray.invD[axis]);
+
+    int32_t lowerBytes, upperBytes;
+    std::memcpy(&lowerBytes, node.lower[axis], 4);
+    std::memcpy(&upperBytes, node.upper[axis], 4);
+    __m128 lower = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(lowerBytes), zero), zero));
+    __m128 upper = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(upperBytes), zero), zero));
+
+    __m128 tLower = _mm_add_ps(_mm_mul_ps(lower, a), b);
+    __m128 tUpper = _mm_add_ps(_mm_mul_ps(upper, a), b);
+    t0 = _mm_max_ps(t0, _mm_min_ps(tLower, tUpper));
+    t1 = _mm_min_ps(t1, _mm_max_ps(tLower, tUpper));
+  }
+
+  __m128i empty = _mm_cmpeq_epi32(
+      _mm_loadu_si128(reinterpret_cast<__m128i const *>(node.child)),
+      _mm_set1_epi32(-1));
+  __m128 hit = _mm_andnot_ps(_mm_castsi128_ps(empty), _mm_cmple_ps(t0, t1));
+  _mm_storeu_ps(tnear, t0);
+  return _mm_movemask_ps(hit);
+#else
+  unsigned mask = 0;
+  for (int child = 0; child != 4; ++child) {
+    if (node.child[child] == EMPTY)
+      continue;
+    float t0 = 0.0f;
+    float t1 = tmax;
+    for (int axis = 0; axis != 3; ++axis) {
+      float a = node.scale[axis] * ray.invD[axis];
+      float b = (node.origin[axis] - ray.O[axis]) * ray.invD[axis];
+      float tLower = node.lower[axis][child] * a + b;
+      float tUpper = node.upper[axis][child] * a + b;
+      t0 = std::max(t0, std::min(tLower, tUpper));
+      t1 = std::min(t1, std::max(tLower, tUpper));
+    }
+    tnear[child] = t0;
+    if (t0 <= t1)
+      mask |= 1u << child;
+  }
+  return mask;
+#endif
+}
+
+inline void BVH4::intersectChildren(Node const &node,
+                                    FloatPacket const &packet, uint32_t active,
+                                    uint32_t masks[4], float tnear[4]) {
+  float const infinity = std::numeric_limits<float>::infinity();
+  for (unsigned child = 0; child != 4; ++child) {
+    masks[child] = 0;
+    tnear[child] = infinity;
+    if (node.child[child] == EMPTY)
+      continue;
+
+    float lower[3], upper[3];
+    for (int axis = 0; axis != 3; ++axis) {
+      lower[axis] =
+          node.origin[axis] + node.lower[axis][child] * node.scale[axis];
+      upper[axis] =
+          node.origin[axis] + node.upper[axis][child] * node.scale[axis];
+    }
+
+#ifdef __SSE2__
+    __m128 nearest = _mm_set1_ps(infinity);
+    for (unsigned lane = 0; lane != MAX_PACKET_SIZE; lane += 4) {
+      unsigned lanes = (active >> lane) & 0xf;
+      if (lanes == 0)
+        continue;
+
+      __m128 t0 = _mm_setzero_ps();
+      __m128 t1 = _mm_load_ps(packet.tmax + lane);
+      for (int axis = 0; axis != 3; ++axis) {
+        __m128 O = _mm_load_ps(packet.O[axis] + lane);
+        __m128 invD = _mm_load_ps(packet.invD[axis] + lane);
+        __m128 tLower =
+            _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[axis]), O), invD);
+        __m128 tUpper =
+            _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[axis]), O), invD);
+        t0 = _mm_max_ps(t0, _mm_min_ps(tLower, tUpper));
+        t1 = _mm_min_ps(t1, _mm_max_ps(tLower, tUpper));
+      }
+
+      __m128 enabled = _mm_castsi128_ps(
+          _mm_set_epi32(-((lanes >> 3) & 1), -((lanes >> 2) & 1),
+                        -((lanes >> 1) & 1), -(lanes & 1)));
+      __m128 hit = _mm_and_ps(enabled, _mm_cmple_ps(t0, t1));
+      masks[child] |= _mm_movemask_ps(hit) << lane;
+      nearest = _mm_min_ps(nearest, _mm_or_ps(_mm_and_ps(hit, t0),
+                                              _mm_andnot_ps(hit, nearest)));
+    }
+    float entries[4];
+    _mm_storeu_ps(entries, nearest);
+    tnear[child] = std::min(std::min(entries[0], entries[1]),
+                            std::min(entries[2], entries[3]));
+#else
+    for (uint32_t lanes = active; lanes != 0; lanes &= lanes - 1) {
+      unsigned lane = __builtin_ctz(lanes);
+      float t0 = 0.0f;
+      float t1 = packet.tmax[lane];
+      for (int axis = 0; axis != 3; ++axis) {
+        float tLower = (lower[axis] - packet.O[axis][lane]) *
+                       packet.invD[axis][lane];
+        float tUpper = (upper[axis] - packet.O[axis][lane]) *
+                       packet.invD[axis][lane];
+        t0 = std::max(t0, std::min(tLower, tUpper));
+        t1 = std::min(t1, std::max(tLower, tUpper));
+      }
+      if (t0 <= t1) {
+        masks[child] |= 1u << lane;
+        tnear[child] = std::min(tnear[child], t0);
+      }
+    }
+#endif
+  }
+}
+
+template <typename HitLeaf>
+void BVH4::intersectLeaves(Ray const &ray, double &tmax,
+                           HitLeaf &&hitLeaf) const {
+  if (empty())
+    return;
+
+  FloatRay floatRay(ray);
+  Entry stack[STACK_SIZE];
+  unsigned top = 0;
+  stack[top++] = Entry{0, 0.0f};
+
+  while (top != 0) {
+    Entry entry = stack[--top];
+    if (entry.tnear > tmax) // a closer hit was found meanwhile
+      continue;
+
+    if (entry.child & LEAF) {
+      unsigned offset = entry.child & LEAF_OFFSET_MASK;
+      unsigned count = ((entry.child & ~LEAF) >> LEAF_COUNT_SHIFT) + 1;
+      hitLeaf(d_indices + offset, count, tmax);
+      continue;
+    }
+
+    float tnear[4];
+    unsigned mask = intersectChildren(d_nodes[entry.child], floatRay,
+                                      toFloat(tmax), tnear);
+
+    // Push the children hit far to near, such that the nearest is next
+    Entry hits[4];
+    unsigned numHits = 0;
+    for (unsigned child = 0; child != 4; ++child) {
+      if (!(mask & (1u << child)))
+        continue;
+      Entry hit{d_nodes[entry.child].child[child], tnear[child]};
+      unsigned pos = numHits++;
+      for (; pos != 0 && hits[pos - 1].tnear < hit.tnear; --pos)
+        hits[pos] = hits[pos - 1];
+      hits[pos] = hit;
+    }
+    for (unsigned idx = 0; idx != numHits; ++idx)
+      stack[top++] = hits[idx];
+  }
+}
+
+template <typename HitLeaf>
+bool BVH4::occludedLeaves(Ray const &ray, double tmax,
+                          HitLeaf &&hitLeaf) const {
+  if (empty())
+    return false;
+
+  FloatRay floatRay(ray);
+  float floatTmax = toFloat(tmax);
+  uint32_t stack[STACK_SIZE];
+  unsigned top = 0;
+  stack[top++] = 0;
+
+  while (top != 0) {
+    uint32_t child = stack[--top];
+
+    if (child & LEAF) {
+      unsigned offset = child & LEAF_OFFSET_MASK;
+      unsigned count = ((child & ~LEAF) >> LEAF_COUNT_SHIFT) + 1;
+      if (hitLeaf(d_indices + offset, count))
+        return true;
+      continue;
+    }
+
+    float tnear[4];
+    Node const &node = d_nodes[child];
+    unsigned mask = intersectChildren(node, floatRay, floatTmax, tnear);
+    for (unsigned idx = 0; idx != 4; ++idx)
+      if (mask & (1u << idx))
+        stack[top++] = node.child[idx];
+  }
+  return false;
+}
+
+template <typename HitLeaf>
+void BVH4::intersectLeaves(Ray const *rays, double *tmax, unsigned count,
+                           HitLeaf &&hitLeaf) const {
+  if (empty() || count == 0)
+    return;
+
+  FloatPacket packet(rays, tmax, count);
+  PacketEntry stack[STACK_SIZE];
+  unsigned top = 0;
+  stack[top++] = PacketEntry{0, (1u << count) - 1, 0.0f};
+
+  while (top != 0) {
+    PacketEntry entry = stack[--top];
+
+    if (entry.child & LEAF) {
+      unsigned offset = entry.child & LEAF_OFFSET_MASK;
+      unsigned numPrimitives = ((entry.child & ~LEAF) >> LEAF_COUNT_SHIFT) + 1;
+      for (uint32_t lanes = entry.active; lanes != 0; lanes &= lanes - 1) {
+        unsigned lane = __builtin_ctz(lanes);
+        hitLeaf(d_indices + offset, numPrimitives, lane);
+        packet.tmax[lane] = toFloat(tmax[lane]);
+      }
+      continue;
+    }
+
+    uint32_t masks[4];
+    float tnear[4];
+    Node const &node = d_nodes[entry.child];
+    intersectChildren(node, packet, entry.active, masks, tnear);
+
+    // Push the children hit far to near, such that the nearest is next
+    PacketEntry hits[4];
+    unsigned numHits = 0;
+    for (unsigned child = 0; child != 4; ++child) {
+      if (masks[child] == 0)
+        continue;
+      PacketEntry hit{node.child[child], masks[child], tnear[child]};
+      unsigned pos = numHits++;
+      for (; pos != 0 && hits[pos - 1].tnear < hit.tnear; --pos)
+        hits[pos] = hits[pos - 1];
+      hits[pos] = hit;
+    }
+    for (unsigned idx = 0; idx != numHits; ++idx)
+      stack[top++] = hits[idx];
+  }
+}
+
+#endif
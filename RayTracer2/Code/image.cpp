@@ -3,28 +3,29 @@
 #include "lode/lodepng.h"
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 using namespace std;
 
 Image::Image(unsigned width, unsigned height)
-    : d_pixels(width * height), d_width(width), d_height(height) {}
+    : d_pixels(3 * width * height), d_width(width), d_height(height) {}
 
 Image::Image(string const &filename) { read_png(filename); }
 
 // normal accessors
 void Image::put_pixel(unsigned x, unsigned y, Color const &c) {
-  (*this)(x, y) = c;
+  unsigned idx = 3 * index(x, y);
+  d_pixels.at(idx) = c.r;
+  d_pixels[idx + 1] = c.g;
+  d_pixels[idx + 2] = c.b;
 }
 Color Image::get_pixel(unsigned x, unsigned y) const { return (*this)(x, y); }
 
-// Handier accessors
+// Handier accessor
 // Usage: color = img(x,y);
-//        img(x,y) = color;
-Color const &Image::operator()(unsigned x, unsigned y) const {
-  return d_pixels.at(index(x, y));
-}
-Color &Image::operator()(unsigned x, unsigned y) {
-  return d_pixels.at(index(x, y));
+Color Image::operator()(unsigned x, unsigned y) const {
+  unsigned idx = 3 * index(x, y);
+  return Color(d_pixels.at(idx), d_pixels[idx + 1], d_pixels[idx + 2]);
 }
 
 unsigned Image::width() const { return d_width; }
@@ -33,19 +34,21 @@ unsigned Image::height() const { return d_height; }
 
 unsigned Image::size() const { return d_width * d_height; }
 
+size_t Image::memoryUsage() const { return d_pixels.size() * sizeof(float); }
+
 // Normalized accessors, unsignederval is (0...1, 0...1)
-// usefull for texture access
-Color const &Image::colorAt(float x, float y) const {
-  return d_pixels.at(findex(x, y));
+Color Image::colorAt(float x, float y) const {
+  unsigned idx = findex(x, y);
+  return (*this)(idx % d_width, idx / d_width);
 }
 
 void Image::write_png(std::string const &filename) const {
   vector<unsigned char> image;
   image.reserve(size() * 4); // reserves size (less allocations)
-  for (Color pixel : d_pixels) {
-    image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-    image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-    image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
+  for (unsigned idx = 0; idx != size(); ++idx) {
+    for (unsigned channel = 0; channel != 3; ++channel)
+      image.push_back(
+          static_cast<unsigned char>(d_pixels[3 * idx + channel] * 255.0));
     image.push_back(255); // alpha is always 1
   }
 
@@ -54,19 +57,21 @@ void Image::write_png(std::string const &filename) const {
 
 void Image::read_png(std::string const &filename) {
   vector<unsigned char> image;
-  lodepng::decode(image, d_width, d_height, filename);
-  d_pixels.reserve(size());
+  if (unsigned error = lodepng::decode(image, d_width, d_height, filename))
+    throw runtime_error("Could not read " + filename + ": " +
+                        lodepng_error_text(error));
+  d_pixels.clear();
+  d_pixels.reserve(3 * size());
 
   auto imgIter = image.begin();
   while (imgIter != image.end()) {
-    double r = (*imgIter) / 255.0;
+    d_pixels.push_back((*imgIter) / 255.0f);
     ++imgIter;
-    double g = (*imgIter) / 255.0;
+    d_pixels.push_back((*imgIter) / 255.0f);
     ++imgIter;
-    double b = (*imgIter) / 255.0;
+    d_pixels.push_back((*imgIter) / 255.0f);
     ++imgIter;
     // Ignore Alpha
     ++imgIter;
-    d_pixels.push_back(Color(r, g, b));
   }
 }
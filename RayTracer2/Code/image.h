@@ -6,8 +6,11 @@
 #include <string>
 #include <vector>
 
+// The framebuffer: colors accumulated in single precision, three floats per
+// pixel, written to a PNG file once the image is rendered. Textures are
+// stored more compactly, see texture.h.
 class Image {
-  std::vector<Color> d_pixels;
+  std::vector<float> d_pixels; // r, g, b per pixel
   unsigned d_width;
   unsigned d_height;
 
@@ -19,19 +22,17 @@ public:
   void put_pixel(unsigned x, unsigned y, Color const &c);
   Color get_pixel(unsigned x, unsigned y) const;
 
-  // Handier accessors
+  // Handier accessor
   // Usage: color = img(x,y);
-  //        img(x,y) = color;
-  Color const &operator()(unsigned x, unsigned y) const;
-  Color &operator()(unsigned x, unsigned y);
+  Color operator()(unsigned x, unsigned y) const;
 
   unsigned width() const;
   unsigned height() const;
   unsigned size() const;
+  size_t memoryUsage() const; // bytes used by the pixels
 
   // Normalized accessors, unsignederval is (0...1, 0...1)
-  // usefull for texture access
-  Color const &colorAt(float x, float y) const;
+  Color colorAt(float x, float y) const;
 
   void write_png(std::string const &filename) const;
   void read_png(std::string const &filename);
@@ -0,0 +1,192 @@
+#include "jsonreader.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+// Initial size of the buffer, it grows to hold the largest value read
+size_t const BUFFER_SIZE = 1 << 20;
+
+bool isSpace(char character) {
+  return character == ' ' || character == '\n' || character == '\r' ||
+         character == '\t';
+}
+} // namespace
+
+JsonReader::JsonReader(string const &filename)
+    : d_filename(filename), d_file(filename, ios::binary),
+      d_buffer(BUFFER_SIZE) {
+  if (!d_file)
+    throw runtime_error("Could not open " + filename + " for reading.");
+  d_file.seekg(0, ios::end);
+  d_size = d_file.tellg();
+  d_file.seekg(0);
+}
+
+void JsonReader::beginObject() {
+  expect('{');
+  d_first.push_back(true);
+}
+
+void JsonReader::beginArray() {
+  expect('[');
+  d_first.push_back(true);
+}
+
+bool JsonReader::nextKey(string &key) {
+  if (d_first.empty())
+    fail("no object entered");
+  if (peek() == '}') {
+    ++d_pos;
+    d_first.pop_back();
+    return false;
+  }
+  if (!d_first.back())
+    expect(',');
+  d_first.back() = false;
+
+  if (peek() != '"')
+    fail("expected a key");
+  size_t length = scan(true);
+  key = json::parse(&d_buffer[d_pos], &d_buffer[d_pos] + length)
+            .get<string>(); // resolves the escapes
+  d_pos += length;
+  expect(':');
+  return true;
+}
+
+bool JsonReader::nextElement() {
+  if (d_first.empty())
+    fail("no array entered");
+  if (peek() == ']') {
+    ++d_pos;
+    d_first.pop_back();
+    return false;
+  }
+  if (!d_first.back())
+    expect(',');
+  d_first.back() = false;
+  return true;
+}
+
+json JsonReader::value() {
+  size_t length = scan(true);
+  json node = json::parse(&d_buffer[d_pos], &d_buffer[d_pos] + length);
+  d_pos += length;
+  return node;
+}
+
+void JsonReader::skip() { d_pos += scan(false); }
+
+void JsonReader::seek(size_t offset) {
+  d_file.clear();
+  d_file.seekg(offset);
+  d_offset = offset;
+  d_pos = d_end = 0;
+  d_first.clear();
+}
+
+bool JsonReader::fill(size_t count) {
+  while (d_end - d_pos < count) {
+    if (d_end == d_buffer.size()) {
+      if (d_pos == 0) { // the value being read fills the buffer
+        d_buffer.resize(2 * d_buffer.size());
+      } else {
+        move(d_buffer.begin() + d_pos, d_buffer.begin() + d_end,
+             d_buffer.begin());
+        d_offset += d_pos;
+        d_end -= d_pos;
+        d_pos = 0;
+      }
+    }
+    d_file.read(&d_buffer[d_end], d_buffer.size() - d_end);
+    size_t read = d_file.gcount();
+    if (read == 0)
+      return false;
+    d_end += read;
+  }
+  return true;
+}
+
+void JsonReader::skipSpace() {
+  while (fill(1) && isSpace(d_buffer[d_pos]))
+    ++d_pos;
+}
+
+char JsonReader::peek() {
+  skipSpace();
+  return d_pos == d_end ? 0 : d_buffer[d_pos];
+}
+
+void JsonReader::expect(char character) {
+  if (peek() != character)
+    fail(string("expected '") + character + "'");
+  ++d_pos;
+}
+
+// The number of characters of the next value, which starts at d_pos after
+// skipping white space. Only the brackets and strings are followed, the
+// value itself is checked when it is parsed. If keep is set, the whole value
+// is buffered from d_pos on, otherwise d_pos moves along with the scan and
+// the rest of the value from d_pos on is returned.
+size_t JsonReader::scan(bool keep) {
+  char first = peek();
+  if (first == 0 || first == ',' || first == '}' || first == ']')
+    fail("expected a value");
+
+  size_t length = 0;
+  unsigned depth = 0;
+  bool inString = false;
+  bool escaped = false;
+  for (;; ++length) {
+    if (d_pos + length == d_end) {
+      if (!keep) {
+        d_pos += length;
+        length = 0;
+      }
+      if (!fill(length + 1))
+        break; // a number at the end of the file
+    }
+
+    char character = d_buffer[d_pos + length];
+    if (inString) {
+      if (escaped)
+        escaped = false;
+      else if (character == '\\')
+        escaped = true;
+      else if (character == '"') {
+        inString = false;
+        if (depth == 0)
+          return length + 1;
+      }
+      continue;
+    }
+
+    if (character == '"') {
+      inString = true;
+    } else if (character == '{' || character == '[') {
+      ++depth;
+    } else if (character == '}' || character == ']') {
+      if (depth == 0)
+        break;
+      if (--depth == 0)
+        return length + 1;
+    } else if (depth == 0 && (character == ',' || isSpace(character))) {
+      break;
+    }
+  }
+
+  if (inString || depth != 0)
+    fail("unexpected end of file");
+  return length;
+}
+
+void JsonReader::fail(string const &what) const {
+  throw runtime_error("Invalid JSON in " + d_filename + " at byte " +
+                      to_string(offset()) + ": " + what + ".");
+}
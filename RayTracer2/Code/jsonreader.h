@@ -0,0 +1,67 @@
+#ifndef JSONREADER_H_
+#define JSONREADER_H_
+
+#include "json/json_fwd.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Reads a JSON document from a file front to back, such that a huge document
+// is never held in memory as a whole. The reader walks the structure of the
+// document (the keys of an object, the elements of an array) itself; every
+// value taken from it is parsed on its own by nlohmann::json. Only the value
+// being read is buffered, values skipped are never buffered as a whole.
+class JsonReader {
+public:
+  explicit JsonReader(std::string const &filename); // throws on failure
+
+  JsonReader(JsonReader const &) = delete;
+  JsonReader &operator=(JsonReader const &) = delete;
+
+  // Enter the object or array which is the next value
+  void beginObject();
+  void beginArray();
+
+  // The key of the next member of the object entered last, after which its
+  // value is next. False at the end of the object, which is then left.
+  bool nextKey(std::string &key);
+
+  // Whether the array entered last has another element, which is then the
+  // next value. False at the end of the array, which is then left.
+  bool nextElement();
+
+  nlohmann::json value(); // the next value, parsed as a whole
+  void skip();            // move past the next value without parsing it
+
+  // Position of the next character in the file. Seeking there continues
+  // reading outside of any object or array.
+  size_t offset() const { return d_offset + d_pos; }
+  void seek(size_t offset);
+
+  size_t size() const { return d_size; } // of the file in bytes
+
+private:
+  std::string d_filename;
+  std::ifstream d_file;
+  size_t d_size;
+
+  // The characters [d_offset, d_offset + d_end) of the file, of which those
+  // before d_pos have been read
+  std::vector<char> d_buffer;
+  size_t d_offset = 0;
+  size_t d_pos = 0;
+  size_t d_end = 0;
+
+  // Per object or array entered, whether no member or element was read yet
+  std::vector<bool> d_first;
+
+  bool fill(size_t count); // false if the file ends before count characters
+  void skipSpace();
+  char peek(); // the next character after white space, 0 at the end
+  void expect(char character);
+  size_t scan(bool keep); // length of the next value, see the .cpp
+  [[noreturn]] void fail(std::string const &what) const;
+};
+
+#endif
@@ -1,33 +1,53 @@
 #include "raytracer.h"
 
+#include <cstdint> // SIZE_MAX
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
 int main(int argc, char *argv[]) {
   cout << "Introduction to Computer Graphics - Raytracer\n\n";
 
-  if (argc < 2 || argc > 3) {
-    cerr << "Usage: " << argv[0] << "in-file [out-file.png]\n";
-    return 1;
+  Raytracer raytracer;
+
+  // the options, the scene file and optionally the image file
+  vector<string> files;
+  bool valid = true;
+  for (int arg = 1; arg < argc; ++arg) {
+    string option = argv[arg];
+    if (option == "--texture-memory" && arg + 1 < argc) {
+      char *end;
+      long megabytes = strtol(argv[++arg], &end, 10);
+      valid = valid && *end == '\0' && megabytes > 0 &&
+              static_cast<unsigned long>(megabytes) <= (SIZE_MAX >> 20);
+      raytracer.setTextureMemory(megabytes);
+    } else {
+      files.push_back(option);
+    }
   }
 
-  Raytracer raytracer;
+  if (!valid || files.size() < 1 || files.size() > 2) {
+    cerr << "Usage: " << argv[0]
+         << " [--texture-memory MiB] in-file [out-file.png]\n";
+    return 1;
+  }
 
   // read the scene
-  if (!raytracer.readScene(argv[1])) {
-    cerr << "Error: reading scene from " << argv[1]
+  if (!raytracer.readScene(files[0])) {
+    cerr << "Error: reading scene from " << files[0]
          << " failed - no output generated.\n";
     return 1;
   }
 
   // determine output name
   string ofname;
-  if (argc >= 3) {
-    ofname = argv[2]; // use the provided name
+  if (files.size() >= 2) {
+    ofname = files[1]; // use the provided name
   } else {
-    ofname = argv[1]; // replace .json with .png
+    ofname = files[0]; // replace .json with .png
     ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
     ofname += ".png";
   }
@@ -0,0 +1,125 @@
+#include "mappedfile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile(string const &filename) : d_data(nullptr), d_size(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw runtime_error("Could not open " + filename + " for reading.");
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw runtime_error("Could not stat " + filename + ".");
+  }
+
+  d_size = info.st_size;
+  if (d_size != 0) { // empty files can't be mapped
+    d_data = mmap(nullptr, d_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (d_data == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("Could not map " + filename + ".");
+    }
+  }
+  close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+  if (d_data)
+    munmap(d_data, d_size);
+}
+
+uint64_t MappedFile::hash() const {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t idx = 0; idx != d_size; ++idx) {
+    hash ^= static_cast<unsigned char>(data()[idx]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool writeAtomically(string const &filename,
+                     function<void(ostream &)> const &contents) {
+  ostringstream tmpname;
+  tmpname << filename << ".tmp" << getpid();
+  ofstream out(tmpname.str(), ios::binary);
+  contents(out);
+  out.close();
+
+  if (!out || rename(tmpname.str().c_str(), filename.c_str()) != 0) {
+    remove(tmpname.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+CacheFile::CacheFile(string const &directory, string const &source,
+                     char const *extension, char const (&magic)[8],
+                     uint32_t version, uint32_t headerSize)
+    : d_directory(directory) {
+  MappedFile file(source);
+
+  memset(&d_header, 0, sizeof(CacheHeader));
+  memcpy(d_header.magic, magic, sizeof(d_header.magic));
+  d_header.version = version;
+  d_header.headerSize = headerSize;
+  d_header.sourceHash = file.hash();
+  d_header.sourceSize = file.size();
+
+  ostringstream name;
+  name << directory << '/' << hex << setw(16) << setfill('0')
+       << d_header.sourceHash << extension;
+  d_name = name.str();
+}
+
+CacheHeader CacheFile::header(uint64_t fileSize) const {
+  CacheHeader header = d_header;
+  header.fileSize = fileSize;
+  return header;
+}
+
+shared_ptr<MappedFile> CacheFile::map() const {
+  if (access(d_name.c_str(), R_OK) != 0)
+    return nullptr;
+  try {
+    return make_shared<MappedFile>(d_name);
+  } catch (exception const &) {
+    return nullptr;
+  }
+}
+
+bool CacheFile::matches(MappedFile const &file) const {
+  if (file.size() < d_header.headerSize)
+    return false;
+  CacheHeader header;
+  memcpy(&header, file.data(), sizeof(CacheHeader));
+  return memcmp(&header, &d_header, offsetof(CacheHeader, fileSize)) == 0 &&
+         header.fileSize == file.size();
+}
+
+bool CacheFile::write(function<void(ostream &)> const &contents) const {
+  if (mkdir(d_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+#pragma omp critical(output)
+    cerr << "Could not create cache directory " << d_directory << ".\n";
+    return false;
+  }
+  if (!writeAtomically(d_name, contents)) {
+#pragma omp critical(output)
+    cerr << "Could not write cache " << d_name << ".\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+  void *d_data;
+  size_t d_size;
+
+public:
+  explicit MappedFile(std::string const &filename); // throws on failure
+  ~MappedFile();
+
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  char const *data() const { return static_cast<char const *>(d_data); }
+  size_t size() const { return d_size; }
+  uint64_t hash() const; // 64 bit FNV-1a of the contents, keys the caches
+};
+
+// Writes filename through contents(out), to a temporary file first such that
+// nobody maps half a file and a failure leaves no file. Returns false when
+// the file could not be written.
+bool writeAtomically(std::string const &filename,
+                     std::function<void(std::ostream &)> const &contents);
+
+// Start of the header of the files of the on-disk caches, identifying the
+// format of the file and the contents of the source file it was made from
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize; // of the whole header of the format
+  uint64_t sourceHash;
+  uint64_t sourceSize;
+  uint64_t fileSize;
+};
+
+// The file of an on-disk cache (see MeshCache and TextureCache) holding the
+// conversion of a source file. It is named <directory>/<hash><extension>
+// after the contents of the source, and entries written by another version
+// of the format, or for other contents, are rejected.
+class CacheFile {
+  std::string d_directory;
+  std::string d_name;
+  CacheHeader d_header; // as written now, but for the file size
+
+public:
+  // Hashes the source, throws when it can't be read
+  CacheFile(std::string const &directory, std::string const &source,
+            char const *extension, char const (&magic)[8], uint32_t version,
+            uint32_t headerSize);
+
+  std::string const &name() const { return d_name; }
+
+  // The header to start the file with, given its size
+  CacheHeader header(uint64_t fileSize) const;
+
+  // Maps the file, nullptr when it is not cached yet
+  std::shared_ptr<MappedFile> map() const;
+
+  // Whether the file starts with the header write() would produce now
+  bool matches(MappedFile const &file) const;
+
+  // Creates the directory and writes the file atomically. Failures are
+  // reported, after which the conversion is simply not cached.
+  bool write(std::function<void(std::ostream &)> const &contents) const;
+};
+
+#endif
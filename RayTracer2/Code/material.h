@@ -8,7 +8,7 @@
 #include <iostream>
 
 class Material {
-  using Surface = mapbox::util::variant<Color, Texture>;
+  using Surface = mapbox::util::variant<Color, TexturePtr>;
 
 public:
   Surface surface;
@@ -24,7 +24,8 @@ public:
     std::cout << "Setting color\n";
   }
 
-  Material(Texture const &texture, double ka, double kd, double ks, double n)
+  Material(TexturePtr const &texture, double ka, double kd, double ks,
+           double n)
       : surface(texture), ka(ka), kd(kd), ks(ks), n(n) {
     std::cout << "Setting texture\n";
   }
@@ -0,0 +1,164 @@
+#include "meshcache.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+char const MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', 0, 0};
+// Increase when the layout of the file, BVH4::Node or the build changes
+uint32_t const VERSION = 3;
+
+// Layout of a cache file: this header, followed by the vertices and the
+// corners of the triangles (see TriangleArray), the nodes (aligned to 64
+// bytes) and the indices of the hierarchy
+struct Header {
+  CacheHeader cache;
+  uint64_t numVertices;
+  uint64_t numTriangles;
+  uint64_t numNodes;
+  uint64_t numIndices;
+  uint64_t verticesOffset;
+  uint64_t trianglesOffset;
+  uint64_t nodesOffset;
+  uint64_t indicesOffset;
+  double bounds[6];
+};
+
+uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+MeshCache::MeshCache(string const &directory) : d_directory(directory) {}
+
+MeshGeometryPtr MeshCache::load(string const &filename) const {
+  unique_ptr<CacheFile> cache;
+  try {
+    cache.reset(new CacheFile(d_directory, filename, ".mesh", MAGIC, VERSION,
+                              sizeof(Header)));
+  } catch (exception const &) {
+    // Let the loader report the problem
+    return MeshGeometryPtr(new MeshGeometry(filename));
+  }
+
+  MeshGeometryPtr geometry = read(*cache);
+  if (geometry) {
+#pragma omp critical(output)
+    cout << "Mapped " << filename << " from " << cache->name() << ".\n";
+    return geometry;
+  }
+
+  geometry = MeshGeometryPtr(new MeshGeometry(filename));
+  write(*cache, *geometry);
+  return geometry;
+}
+
+MeshGeometryPtr MeshCache::read(CacheFile const &cache) const {
+  shared_ptr<MappedFile> file = cache.map();
+  if (!file)
+    return nullptr; // not cached yet
+
+  auto stale = [&]() {
+#pragma omp critical(output)
+    cerr << "Ignoring stale mesh cache " << cache.name() << ".\n";
+    return nullptr;
+  };
+
+  // Reject anything that is not exactly what write() would produce now. The
+  // counts are checked against the size first, such that the offsets
+  // computed from them can not overflow.
+  if (!cache.matches(*file))
+    return stale();
+  Header header;
+  memcpy(&header, file->data(), sizeof(Header));
+  uint64_t fileSize = file->size();
+  if (header.numVertices > fileSize / (3 * sizeof(float)) ||
+      header.numTriangles > fileSize / (3 * sizeof(unsigned)) ||
+      header.numNodes > fileSize / sizeof(BVH4::Node) ||
+      header.numIndices > fileSize / sizeof(unsigned) ||
+      header.verticesOffset > fileSize || header.trianglesOffset > fileSize ||
+      header.nodesOffset > fileSize || header.indicesOffset > fileSize ||
+      header.nodesOffset % 64 != 0 ||
+      header.verticesOffset % sizeof(float) != 0 ||
+      header.verticesOffset + 3 * header.numVertices * sizeof(float) >
+          header.trianglesOffset ||
+      header.trianglesOffset % sizeof(unsigned) != 0 ||
+      header.trianglesOffset + 3 * header.numTriangles * sizeof(unsigned) >
+          header.nodesOffset ||
+      header.nodesOffset + header.numNodes * sizeof(BVH4::Node) >
+          header.indicesOffset ||
+      header.indicesOffset + header.numIndices * sizeof(unsigned) > fileSize)
+    return stale();
+
+  // The corners are used without bounds checks, so a damaged file must not
+  // refer to vertices outside of it
+  unsigned const *corners =
+      reinterpret_cast<unsigned const *>(file->data() + header.trianglesOffset);
+  for (size_t idx = 0; idx != 3 * header.numTriangles; ++idx)
+    if (corners[idx] >= header.numVertices)
+      return stale();
+
+  // The triangles and hierarchy are used straight from the mapping
+  TriangleArray triangles;
+  triangles.assign(
+      reinterpret_cast<float const *>(file->data() + header.verticesOffset),
+      header.numVertices, corners, header.numTriangles, file);
+
+  BVH4 bvh;
+  bvh.assign(
+      reinterpret_cast<BVH4::Node const *>(file->data() + header.nodesOffset),
+      header.numNodes,
+      reinterpret_cast<unsigned const *>(file->data() + header.indicesOffset),
+      header.numIndices,
+      AABB(Point(header.bounds[0], header.bounds[1], header.bounds[2]),
+           Point(header.bounds[3], header.bounds[4], header.bounds[5])),
+      file);
+  if (!bvh.valid(header.numTriangles))
+    return stale();
+
+  return MeshGeometryPtr(new MeshGeometry(triangles, bvh));
+}
+
+void MeshCache::write(CacheFile const &cache,
+                      MeshGeometry const &geometry) const {
+  TriangleArray const &triangles = geometry.getTriangles();
+  BVH4 const &bvh = geometry.getBVH();
+
+  Header header;
+  header.numVertices = triangles.numVertices();
+  header.numTriangles = triangles.size();
+  header.numNodes = bvh.numNodes();
+  header.numIndices = bvh.numIndices();
+  header.verticesOffset = sizeof(Header);
+  header.trianglesOffset =
+      header.verticesOffset + 3 * header.numVertices * sizeof(float);
+  header.nodesOffset = alignUp(
+      header.trianglesOffset + 3 * header.numTriangles * sizeof(unsigned),
+      64);
+  header.indicesOffset =
+      header.nodesOffset + header.numNodes * sizeof(BVH4::Node);
+  header.cache =
+      cache.header(header.indicesOffset + header.numIndices * sizeof(unsigned));
+  AABB bounds = bvh.bounds();
+  for (int axis = 0; axis != 3; ++axis) {
+    header.bounds[axis] = bounds.min.data[axis];
+    header.bounds[3 + axis] = bounds.max.data[axis];
+  }
+
+  cache.write([&](ostream &out) {
+    out.write(reinterpret_cast<char const *>(&header), sizeof(Header));
+    out.write(reinterpret_cast<char const *>(triangles.vertexData()),
+              3 * header.numVertices * sizeof(float));
+    out.write(reinterpret_cast<char const *>(triangles.indexData()),
+              3 * header.numTriangles * sizeof(unsigned));
+    vector<char> padding(header.nodesOffset - out.tellp(), 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<char const *>(bvh.nodeData()),
+              header.numNodes * sizeof(BVH4::Node));
+    out.write(reinterpret_cast<char const *>(bvh.indexData()),
+              header.numIndices * sizeof(unsigned));
+  });
+}
@@ -0,0 +1,28 @@
+#ifndef MESHCACHE_H_
+#define MESHCACHE_H_
+
+#include "mappedfile.h"
+#include "shapes/meshgeometry.h"
+
+#include <string>
+
+// On-disk cache of loaded models. After a model is loaded its triangles and
+// the hierarchy over them are written to <directory>/<hash>.mesh, where hash
+// is computed from the contents of the .obj file. Later runs map that file
+// instead of parsing the model and building the hierarchy again. Entries
+// written by another version of the format, or for other contents, are
+// rebuilt.
+class MeshCache {
+  std::string d_directory;
+
+public:
+  explicit MeshCache(std::string const &directory);
+
+  MeshGeometryPtr load(std::string const &filename) const;
+
+private:
+  MeshGeometryPtr read(CacheFile const &cache) const;
+  void write(CacheFile const &cache, MeshGeometry const &geometry) const;
+};
+
+#endif
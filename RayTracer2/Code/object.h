@@ -1,6 +1,7 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include "aabb.h"
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
@@ -27,6 +28,16 @@ public:
                                              // in derived class
   virtual TextureCoordinates textureCoordinates(Point const &point) = 0;
 
+  // Any hit query: whether the object is hit within the interval of the ray.
+  // Shapes can override this to skip the work only needed for the normal.
+  virtual bool occluded(Ray const &ray) {
+    return ray.contains(intersect(ray).t);
+  }
+
+  // Bounds of the object, used to place it in the scene's hierarchy.
+  // Objects without finite bounds (e.g. planes) keep the default.
+  virtual AABB boundingBox() const { return AABB::INFINITE(); }
+
   // Set the axis of rotation, and the angle from vector
   void setRotation(Vector const &vector, double const angle) {
     axis = vector.normalized();
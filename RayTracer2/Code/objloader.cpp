@@ -3,12 +3,140 @@
 // Pro C++ Tip: here you can specify other includes you may need
 // such as <iostream>
 
-#include <fstream>
+#include "binarymesh.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <omp.h>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 
 using namespace std;
 
+namespace {
+// Files are split in chunks of about this many bytes, parsed in parallel
+size_t const CHUNK_SIZE = 1 << 20;
+
+// The powers of ten that floats hold exactly
+float const POWERS_OF_TEN[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                               1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+bool isSpace(char ch) { return ch == ' ' || ch == '\t' || ch == '\r'; }
+bool isDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+char const *skipSpace(char const *pos, char const *end) {
+  while (pos != end && isSpace(*pos))
+    ++pos;
+  return pos;
+}
+
+// Parses the number after pos in place, moving pos past it, with the same
+// result as stof. Decimals with few digits, as .obj files hold, are
+// computed exactly with a single rounding: both the digits and the power of
+// ten are floats without rounding. Other numbers are handed to stof.
+float parseFloat(char const *&pos, char const *end) {
+  pos = skipSpace(pos, end);
+  char const *token = pos;
+  char const *ch = pos;
+  bool negative = ch != end && *ch == '-';
+  if (ch != end && (*ch == '-' || *ch == '+'))
+    ++ch;
+
+  uint32_t mantissa = 0;
+  int exponent = 0;
+  bool exact = true;
+  char const *digits = ch;
+  for (; ch != end && isDigit(*ch); ++ch) {
+    exact = exact && mantissa < (1u << 24) / 10;
+    mantissa = mantissa * 10 + (*ch - '0');
+  }
+  size_t numDigits = ch - digits;
+  if (ch != end && *ch == '.') {
+    digits = ++ch;
+    for (; ch != end && isDigit(*ch); ++ch) {
+      exact = exact && mantissa < (1u << 24) / 10;
+      mantissa = mantissa * 10 + (*ch - '0');
+      --exponent;
+    }
+    numDigits += ch - digits;
+  }
+  if (numDigits != 0 && ch != end && (*ch == 'e' || *ch == 'E')) {
+    ++ch;
+    bool negativeExponent = ch != end && *ch == '-';
+    if (ch != end && (*ch == '-' || *ch == '+'))
+      ++ch;
+    int value = 0;
+    exact = exact && ch != end && isDigit(*ch);
+    for (; ch != end && isDigit(*ch); ++ch)
+      value = min(value * 10 + (*ch - '0'), 1000);
+    exponent += negativeExponent ? -value : value;
+  }
+
+  if (exact && numDigits != 0 && exponent >= -10 && exponent <= 10 &&
+      (ch == end || isSpace(*ch))) {
+    pos = ch;
+    float value = exponent < 0 ? mantissa / POWERS_OF_TEN[-exponent]
+                               : mantissa * POWERS_OF_TEN[exponent];
+    return negative ? -value : value;
+  }
+
+  while (ch != end && !isSpace(*ch))
+    ++ch;
+  pos = ch;
+  return stof(string(token, ch));
+}
+
+// Parses the unsigned number at pos in place, moving pos past it
+unsigned parseIndex(char const *&pos, char const *end) {
+  if (pos == end || !isDigit(*pos))
+    throw invalid_argument("Invalid index in .obj file.");
+  uint64_t value = 0;
+  for (; pos != end && isDigit(*pos); ++pos) {
+    value = value * 10 + (*pos - '0');
+    if (value > 0xffffffffu)
+      throw out_of_range("Index too large in .obj file.");
+  }
+  return value;
+}
+
+// Indices of the coordinate, normal and texture coordinates of a corner
+typedef tuple<unsigned, unsigned, unsigned> Corner;
+
+struct CornerHash {
+  size_t operator()(Corner const &corner) const {
+    return get<0>(corner) * 73856093 ^ get<1>(corner) * 19349663 ^
+           get<2>(corner) * 83492791;
+  }
+};
+
+template <typename Task> void spawnTasks(size_t count, Task const &task) {
+  for (size_t idx = 0; idx != count; ++idx) {
+#pragma omp task shared(task)
+    task(idx);
+  }
+#pragma omp taskwait
+}
+
+// Calls task(idx) for idx in [0, count), each in its own task. When we are
+// already part of a team (several models being loaded at once) the tasks
+// are shared with that team.
+template <typename Task> void inTasks(size_t count, Task const &task) {
+  if (omp_in_parallel()) {
+    spawnTasks(count, task);
+  } else {
+#pragma omp parallel
+#pragma omp single
+    spawnTasks(count, task);
+  }
+}
+} // namespace
+
 // ===================================================================
 // -- Constructors and destructor ------------------------------------
 // ===================================================================
@@ -27,40 +155,54 @@ OBJLoader::OBJLoader(string const &filename) : d_hasTexCoords(false) {
 
 vector<Vertex> OBJLoader::vertex_data() const {
   vector<Vertex> data;
+  data.reserve(d_vertices.size());
 
   // For all vertices in the model, interleave the data
-  for (Vertex_idx const &vertex : d_vertices) {
-    // Add coordinate data
-    Vertex vert;
-
-    vec3 const coord = d_coordinates.at(vertex.d_coord);
-    vert.x = coord.x;
-    vert.y = coord.y;
-    vert.z = coord.z;
-
-    // Add normal data
-    vec3 const norm = d_normals.at(vertex.d_norm);
-    vert.nx = norm.x;
-    vert.ny = norm.y;
-    vert.nz = norm.z;
-
-    // Add texture data (if available)
-    if (d_hasTexCoords) {
-      vec2 const tex = d_texCoords.at(vertex.d_tex);
-      vert.u = tex.u; // u coordinate
-      vert.v = tex.v; // v coordinate
-    } else {
-      vert.u = 0;
-      vert.v = 0;
-    }
-    data.push_back(vert);
-  }
+  for (Vertex_idx const &vertex_idx : d_vertices)
+    data.push_back(vertex(vertex_idx));
 
   return data; // copy elision
 }
 
+void OBJLoader::indexed_data(vector<Vertex> &vertices,
+                             vector<unsigned> &indices) const {
+  vertices.clear();
+  indices.clear();
+  indices.reserve(d_vertices.size());
+
+  // Corners with the same coordinate, normal and texture indices share
+  // a vertex
+  unordered_map<Corner, unsigned, CornerHash> unique;
+  for (Vertex_idx const &vertex_idx : d_vertices) {
+    Corner corner{vertex_idx.d_coord, vertex_idx.d_norm,
+                  d_hasTexCoords ? vertex_idx.d_tex : 0};
+    auto inserted = unique.insert(make_pair(corner, vertices.size()));
+    if (inserted.second)
+      vertices.push_back(vertex(vertex_idx));
+    indices.push_back(inserted.first->second);
+  }
+}
+
+void OBJLoader::indexed_positions(vector<float> &positions,
+                                  vector<unsigned> &indices) const {
+  positions.clear();
+  positions.reserve(3 * d_coordinates.size());
+  for (vec3 const &coord : d_coordinates)
+    positions.insert(positions.end(), {coord.x, coord.y, coord.z});
+
+  indices.clear();
+  indices.reserve(d_vertices.size());
+  for (Vertex_idx const &vertex : d_vertices) {
+    if (vertex.d_coord >= d_coordinates.size())
+      throw out_of_range("Vertex index out of range in .obj file.");
+    indices.push_back(vertex.d_coord);
+  }
+}
+
 unsigned OBJLoader::numTriangles() const { return d_vertices.size() / 3U; }
 
+bool OBJLoader::hasNormals() const { return !d_normals.empty(); }
+
 bool OBJLoader::hasTexCoords() const { return d_hasTexCoords; }
 
 void OBJLoader::unitize() {
@@ -91,91 +233,188 @@ void OBJLoader::unitize() {
 
 // --- Private -------------------------------------------------------
 
-void OBJLoader::parseFile(string const &filename) {
-  ifstream file(filename);
-  if (file) {
-    string line;
-    while (getline(file, line))
-      parseLine(line);
+// The interleaved data of a vertex, without normals the normal is zero
+Vertex OBJLoader::vertex(Vertex_idx const &vertex) const {
+  // Add coordinate data
+  Vertex vert;
+
+  vec3 const coord = d_coordinates.at(vertex.d_coord);
+  vert.x = coord.x;
+  vert.y = coord.y;
+  vert.z = coord.z;
+
+  // Add normal data
+  vec3 const norm =
+      d_normals.empty() ? vec3{0, 0, 0} : d_normals.at(vertex.d_norm);
+  vert.nx = norm.x;
+  vert.ny = norm.y;
+  vert.nz = norm.z;
+
+  // Add texture data (if available)
+  if (d_hasTexCoords) {
+    vec2 const tex = d_texCoords.at(vertex.d_tex);
+    vert.u = tex.u; // u coordinate
+    vert.v = tex.v; // v coordinate
   } else {
-    cerr << "Could not open: " << filename << " for reading!\n";
+    vert.u = 0;
+    vert.v = 0;
   }
+  return vert;
 }
 
-void OBJLoader::parseLine(string const &line) {
-  if (line[0] == '#')
-    return; // ignore comments
+void OBJLoader::parseFile(string const &filename) {
+  unique_ptr<MappedFile> file;
+  try {
+    file.reset(new MappedFile(filename));
+  } catch (exception const &) {
+    cerr << "Could not open: " << filename << " for reading!\n";
+    return;
+  }
 
-  StringList tokens = split(line, ' ', false);
+  if (BinaryMeshHeader::matches(file->data(), file->size())) {
+    parseBinary(file->data(), file->size(), filename);
+    return;
+  }
 
-  if (tokens[0] == "v")
-    parseVertex(tokens);
-  else if (tokens[0] == "vn")
-    parseNormal(tokens);
-  else if (tokens[0] == "vt")
-    parseTexCoord(tokens);
-  else if (tokens[0] == "f")
-    parseFace(tokens);
+  // Split the file in chunks ending at the end of a line
+  char const *end = file->data() + file->size();
+  vector<char const *> bounds{file->data()};
+  while (bounds.back() != end) {
+    size_t size = min<size_t>(CHUNK_SIZE, end - bounds.back());
+    char const *pos = find(bounds.back() + size, end, '\n');
+    bounds.push_back(pos == end ? end : pos + 1);
+  }
 
-  // Other data is also ignored
+  size_t numChunks = bounds.size() - 1;
+  vector<Chunk> chunks(numChunks);
+  vector<exception_ptr> errors(numChunks);
+  inTasks(numChunks, [&](size_t idx) {
+    try {
+      parseChunk(bounds[idx], bounds[idx + 1], chunks[idx]);
+    } catch (...) {
+      errors[idx] = current_exception();
+    }
+  });
+  for (exception_ptr const &error : errors)
+    if (error)
+      rethrow_exception(error);
+
+  // The indices of the faces count from the start of the file, so the
+  // chunks are simply joined
+  size_t sizes[4] = {};
+  for (Chunk const &chunk : chunks) {
+    sizes[0] += chunk.coordinates.size();
+    sizes[1] += chunk.normals.size();
+    sizes[2] += chunk.texCoords.size();
+    sizes[3] += chunk.vertices.size();
+  }
+  d_coordinates.reserve(sizes[0]);
+  d_normals.reserve(sizes[1]);
+  d_texCoords.reserve(sizes[2]);
+  d_vertices.reserve(sizes[3]);
+  for (Chunk const &chunk : chunks) {
+    d_hasTexCoords = d_hasTexCoords || chunk.hasTexCoords;
+    d_coordinates.insert(d_coordinates.end(), chunk.coordinates.begin(),
+                         chunk.coordinates.end());
+    d_normals.insert(d_normals.end(), chunk.normals.begin(),
+                     chunk.normals.end());
+    d_texCoords.insert(d_texCoords.end(), chunk.texCoords.begin(),
+                       chunk.texCoords.end());
+    d_vertices.insert(d_vertices.end(), chunk.vertices.begin(),
+                      chunk.vertices.end());
+  }
 }
 
-void OBJLoader::parseVertex(StringList const &tokens) {
-  float x, y, z;
-  x = stof(tokens.at(1)); // 0 is the "v" token
-  y = stof(tokens.at(2));
-  z = stof(tokens.at(3));
-  d_coordinates.push_back(vec3{x, y, z});
-}
+// Copies the arrays of a binary mesh, each corner refers to a vertex
+void OBJLoader::parseBinary(char const *data, size_t size,
+                            string const &filename) {
+  BinaryMeshHeader header;
+  memcpy(&header, data, sizeof(BinaryMeshHeader));
+  if (!header.valid(size))
+    throw runtime_error("Invalid binary mesh " + filename + ".");
+
+  size_t numVertices = header.numVertices;
+  d_coordinates.resize(numVertices);
+  memcpy(d_coordinates.data(), data + header.positionsOffset,
+         numVertices * sizeof(vec3));
+  if (header.flags & BinaryMeshHeader::NORMALS) {
+    d_normals.resize(numVertices);
+    memcpy(d_normals.data(), data + header.normalsOffset,
+           numVertices * sizeof(vec3));
+  }
+  if (header.flags & BinaryMeshHeader::TEX_COORDS) {
+    d_hasTexCoords = true;
+    d_texCoords.resize(numVertices);
+    memcpy(d_texCoords.data(), data + header.texCoordsOffset,
+           numVertices * sizeof(vec2));
+  }
 
-void OBJLoader::parseNormal(StringList const &tokens) {
-  float x, y, z;
-  x = stof(tokens.at(1)); // 0 is the "vn" token
-  y = stof(tokens.at(2));
-  z = stof(tokens.at(3));
-  d_normals.push_back(vec3{x, y, z});
+  uint32_t const *indices =
+      reinterpret_cast<uint32_t const *>(data + header.indicesOffset);
+  d_vertices.reserve(header.numIndices);
+  for (size_t idx = 0; idx != header.numIndices; ++idx) {
+    if (indices[idx] >= numVertices)
+      throw runtime_error("Invalid index in binary mesh " + filename + ".");
+    d_vertices.push_back(Vertex_idx{indices[idx], indices[idx], indices[idx]});
+  }
 }
 
-void OBJLoader::parseTexCoord(StringList const &tokens) {
-  d_hasTexCoords = true; // Texture data will be read
+void OBJLoader::parseChunk(char const *begin, char const *end, Chunk &chunk) {
+  while (begin != end) {
+    char const *eol =
+        static_cast<char const *>(memchr(begin, '\n', end - begin));
+    if (!eol)
+      eol = end;
+    parseLine(begin, eol, chunk);
+    begin = eol == end ? end : eol + 1;
+  }
+}
 
-  float u, v;
-  u = stof(tokens.at(1)); // 0 is the "vt" token
-  v = stof(tokens.at(2));
-  d_texCoords.push_back(vec2{u, v});
+void OBJLoader::parseLine(char const *pos, char const *end, Chunk &chunk) {
+  pos = skipSpace(pos, end);
+  char const *keyword = pos;
+  while (pos != end && !isSpace(*pos))
+    ++pos;
+  size_t length = pos - keyword;
+
+  // Comments and other data are ignored
+  if (length == 1 && keyword[0] == 'v') {
+    float x = parseFloat(pos, end);
+    float y = parseFloat(pos, end);
+    float z = parseFloat(pos, end);
+    chunk.coordinates.push_back(vec3{x, y, z});
+  } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+    float x = parseFloat(pos, end);
+    float y = parseFloat(pos, end);
+    float z = parseFloat(pos, end);
+    chunk.normals.push_back(vec3{x, y, z});
+  } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+    chunk.hasTexCoords = true; // Texture data will be read
+    float u = parseFloat(pos, end);
+    float v = parseFloat(pos, end);
+    chunk.texCoords.push_back(vec2{u, v});
+  } else if (length == 1 && keyword[0] == 'f') {
+    parseFace(pos, end, chunk);
+  }
 }
 
-void OBJLoader::parseFace(StringList const &tokens) {
-  // skip the first token ("f")
-  for (size_t idx = 1; idx < tokens.size(); ++idx) {
+void OBJLoader::parseFace(char const *pos, char const *end, Chunk &chunk) {
+  while ((pos = skipSpace(pos, end)) != end) {
     // format is:
     // <vertex idx + 1>/<texture idx +1>/<normal idx + 1>
     // Wavefront .obj files start counting from 1 (yuck)
-
-    StringList elements = split(tokens.at(idx), '/');
-    Vertex_idx vertex{}; // initialize to zeros on all fields
-
-    vertex.d_coord = stoul(elements.at(0)) - 1U;
-
-    if (d_hasTexCoords)
-      vertex.d_tex = stoul(elements.at(1)) - 1U;
-    else
-      vertex.d_tex = 0U; // ignored
-
-    vertex.d_norm = stoul(elements.at(2)) - 1U;
-
-    d_vertices.push_back(vertex);
+    // Missing texture and normal indices are read as 1.
+    unsigned indices[3] = {1, 1, 1};
+    for (unsigned element = 0; element != 3; ++element) {
+      if (pos != end && *pos != '/')
+        indices[element] = parseIndex(pos, end);
+      if (pos == end || *pos != '/')
+        break;
+      ++pos;
+    }
+    if (pos != end && !isSpace(*pos))
+      throw invalid_argument("Invalid face element in .obj file.");
+    chunk.vertices.push_back(
+        Vertex_idx{indices[0] - 1U, indices[2] - 1U, indices[1] - 1U});
   }
 }
-
-OBJLoader::StringList OBJLoader::split(string const &line, char splitChar,
-                                       bool keepEmpty) {
-  StringList tokens;
-  istringstream iss(line);
-  string token;
-  while (getline(iss, token, splitChar))
-    if (token.size() > 0 || (token.size() == 0 && keepEmpty))
-      tokens.push_back(token);
-
-  return tokens;
-}
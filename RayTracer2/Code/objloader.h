@@ -35,19 +35,26 @@ class OBJLoader {
    * the model
    */
   struct Vertex_idx {
-    size_t d_coord;
-    size_t d_norm;
-    size_t d_tex;
+    unsigned d_coord;
+    unsigned d_norm;
+    unsigned d_tex;
   };
 
   std::vector<Vertex_idx> d_vertices;
 
-  typedef std::vector<std::string> StringList;
+  // The data of a part of the file, parsed on its own
+  struct Chunk {
+    bool hasTexCoords = false;
+    std::vector<vec3> coordinates;
+    std::vector<vec3> normals;
+    std::vector<vec2> texCoords;
+    std::vector<Vertex_idx> vertices;
+  };
 
 public:
   /**
    * @brief OBJLoader
-   * @param filename
+   * @param filename of an .obj file, or of a binary mesh (see binarymesh.h)
    */
   explicit OBJLoader(std::string const &filename);
 
@@ -60,8 +67,27 @@ public:
    */
   std::vector<Vertex> vertex_data() const;
 
+  /**
+   * @brief indexed_data
+   * @param vertices receives the unique vertices, as in vertex_data
+   * @param indices receives the index of the vertex of every corner,
+   *  three per triangle
+   */
+  void indexed_data(std::vector<Vertex> &vertices,
+                    std::vector<unsigned> &indices) const;
+
+  /**
+   * @brief indexed_positions
+   * @param positions receives x, y and z of every position in the file
+   * @param indices receives the index of the position of every corner,
+   *  three per triangle
+   */
+  void indexed_positions(std::vector<float> &positions,
+                         std::vector<unsigned> &indices) const;
+
   unsigned numTriangles() const;
 
+  bool hasNormals() const;
   bool hasTexCoords() const;
 
   /**
@@ -72,15 +98,12 @@ public:
   void unitize();
 
 private:
+  Vertex vertex(Vertex_idx const &vertex) const;
   void parseFile(std::string const &filename);
-  void parseLine(std::string const &line);
-  void parseVertex(StringList const &tokens);
-  void parseNormal(StringList const &tokens);
-  void parseTexCoord(StringList const &tokens);
-  void parseFace(StringList const &tokens);
-
-  StringList split(std::string const &str, char splitChar,
-                   bool keepEmpty = true);
+  void parseBinary(char const *data, size_t size, std::string const &filename);
+  static void parseChunk(char const *begin, char const *end, Chunk &chunk);
+  static void parseLine(char const *pos, char const *end, Chunk &chunk);
+  static void parseFace(char const *pos, char const *end, Chunk &chunk);
 };
 
 #endif // OBJLOADER_H_
@@ -3,14 +3,56 @@
 
 #include "triple.h"
 
+#include <limits>
+
 class Ray {
 public:
   Point O;  // origin
   Vector D; // direction of the ray
 
-  Ray(Point const &from, Vector const &dir) : O(from), D(dir) {}
+  // Only hits at a distance in (tmin, tmax) count. Shadow rays end at the
+  // light, closest hit searches lower tmax to the best hit found so far.
+  double tmin;
+  double tmax;
+
+  Ray(Point const &from, Vector const &dir, double tmin = 0.0,
+      double tmax = std::numeric_limits<double>::infinity())
+      : O(from), D(dir), tmin(tmin), tmax(tmax) {}
 
   Point at(double t) const { return O + t * D; }
+
+  // Whether a hit at distance t lies inside the interval (false for NaN)
+  bool contains(double t) const { return t > tmin && t < tmax; }
+};
+
+// Ray differentials (Igehy, 1999): how the origin and direction of a ray
+// change from one sample to the next in x and in y on the image. Carried
+// along primary and reflection rays, they give the footprint of a sample on
+// the surfaces it hits, which selects the level of detail of textures.
+struct RayDifferentials {
+  Vector dOdx, dOdy;
+  Vector dDdx, dDdy;
+
+  // Differentials of the hit ray.at(t) on a surface with normal N
+  void transfer(Ray const &ray, double t, Vector const &N, Vector &dPdx,
+                Vector &dPdy) const {
+    double DdotN = ray.D.dot(N);
+    Vector dx = dOdx + t * dDdx;
+    Vector dy = dOdy + t * dDdy;
+    dPdx = dx - (dx.dot(N) / DdotN) * ray.D;
+    dPdy = dy - (dy.dot(N) / DdotN) * ray.D;
+  }
+
+  // Differentials of the mirror reflection (see Scene::reflectionRay) of
+  // the ray at that hit. The surface is taken to be locally flat, so its
+  // curvature does not widen the footprint.
+  RayDifferentials reflect(Ray const &ray, double t, Vector const &N) const {
+    RayDifferentials reflected;
+    transfer(ray, t, N, reflected.dOdx, reflected.dOdy);
+    reflected.dDdx = dDdx - N * 2.0 * dDdx.dot(N);
+    reflected.dDdy = dDdy - N * 2.0 * dDdy.dot(N);
+    return reflected;
+  }
 };
 
 #endif
@@ -1,8 +1,11 @@
 #include "raytracer.h"
 
+#include "binaryscene.h"
 #include "image.h"
+#include "jsonreader.h"
 #include "light.h"
 #include "material.h"
+#include "meshcache.h"
 #include "triple.h"
 
 // =============================================================================
@@ -19,12 +22,18 @@
 // -- End of shape includes ----------------------------------------------------
 // =============================================================================
 
+#include "accelerators/bvhaccelerator.h"
+#include "accelerators/gridaccelerator.h"
+#include "accelerators/linearaccelerator.h"
+
 #include "json/json.h"
 
+#include <chrono>
+#include <cstdint> // SIZE_MAX
 #include <exception>
-#include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std; // no std:: required
 using json = nlohmann::json;
@@ -58,7 +67,13 @@ bool Raytracer::parseObjectNode(json const &node) {
     std::string filename = node["model"];
     Vector translation(node["position"]);
     double scale = node["scale"];
-    obj = ObjectPtr(new Mesh(filename, translation, scale));
+    obj = placeMesh(filename, translation, scale);
+
+    auto rotation = node.find("rotation");
+    auto angle = node.find("angle");
+    if (rotation != node.end() && angle != node.end()) {
+      obj->setRotation(Vector(*rotation), *angle);
+    }
   } else if (node["type"] == "plane") {
     Point point(node["point"]);
     Vector N(node["normal"]);
@@ -81,11 +96,111 @@ bool Raytracer::parseObjectNode(json const &node) {
     return false;
 
   // Parse material and add object to the scene
-  obj->material = parseMaterialNode(node["material"]);
+  parseMaterialNode(node["material"], obj->material);
   scene.addObject(obj);
   return true;
 }
 
+// A mesh of a model, which gets its geometry once the model is loaded if it
+// was not loaded before
+ObjectPtr Raytracer::placeMesh(string const &filename,
+                               Vector const &translation, double scale) {
+  auto loaded = meshes.find(filename);
+  if (loaded != meshes.end())
+    return ObjectPtr(new Mesh(loaded->second, translation, scale));
+
+  Mesh *mesh = new Mesh(nullptr, translation, scale);
+  unloadedMeshes[filename].push_back(mesh);
+  return ObjectPtr(mesh);
+}
+
+MeshGeometryPtr Raytracer::readMesh(string const &filename) const {
+  return useMeshCache ? MeshCache(meshCacheDirectory).load(filename)
+                      : MeshGeometryPtr(new MeshGeometry(filename));
+}
+
+// Load the models and textures of the objects read so far. Every file is
+// loaded once, in a task of its own, so the models (which build their
+// hierarchies in tasks of their own) and textures are decoded concurrently.
+// Once all are loaded they are handed to the objects using them, whose order
+// was fixed when they were read.
+void Raytracer::loadAssets() {
+  vector<string> models;
+  for (auto const &unloaded : unloadedMeshes)
+    models.push_back(unloaded.first);
+  vector<string> textures;
+  for (auto const &unloaded : unloadedTextures)
+    textures.push_back(unloaded.first);
+
+  vector<MeshGeometryPtr> geometries(models.size());
+  vector<TexturePtr> images(textures.size());
+  vector<exception_ptr> errors(models.size() + textures.size());
+#pragma omp parallel
+#pragma omp single
+  {
+    for (size_t idx = 0; idx != models.size(); ++idx) {
+#pragma omp task shared(models, geometries, errors)
+      try {
+        geometries[idx] = readMesh(models[idx]);
+      } catch (...) {
+        errors[idx] = current_exception();
+      }
+    }
+    for (size_t idx = 0; idx != textures.size(); ++idx) {
+#pragma omp task shared(textures, images, errors)
+      try {
+        images[idx] = TextureStore::instance().load(textures[idx]);
+      } catch (...) {
+        errors[models.size() + idx] = current_exception();
+      }
+    }
+  }
+
+  for (exception_ptr const &error : errors)
+    if (error)
+      rethrow_exception(error);
+
+  for (size_t idx = 0; idx != models.size(); ++idx) {
+    cout << "Loaded " << models[idx] << " ("
+         << geometries[idx]->numTriangles() << " triangles, "
+         << geometries[idx]->memoryUsage() / 1024 << " KiB).\n";
+    meshes[models[idx]] = geometries[idx];
+    for (Mesh *mesh : unloadedMeshes[models[idx]])
+      mesh->setGeometry(geometries[idx]);
+  }
+  unloadedMeshes.clear();
+
+  for (size_t idx = 0; idx != textures.size(); ++idx)
+    for (Material *material : unloadedTextures[textures[idx]])
+      material->surface = images[idx];
+  unloadedTextures.clear();
+}
+
+AcceleratorPtr Raytracer::parseAccelerator(json const &node) const {
+  if (node == "bvh")
+    return AcceleratorPtr(new BVHAccelerator());
+  else if (node == "grid")
+    return AcceleratorPtr(new GridAccelerator());
+  else if (node == "none")
+    return AcceleratorPtr(new LinearAccelerator());
+  else
+    throw runtime_error("Unknown accelerator, use bvh, grid or none.");
+}
+
+Texture::Filter Raytracer::parseTextureFilter(json const &node) const {
+  if (node == "nearest")
+    return Texture::NEAREST;
+  else if (node == "bilinear")
+    return Texture::BILINEAR;
+  else if (node == "trilinear")
+    return Texture::TRILINEAR;
+  else if (node == "anisotropic")
+    return Texture::ANISOTROPIC;
+  else
+    throw runtime_error("Unknown texture filter, use nearest, bilinear, "
+                        "trilinear or anisotropic.");
+}
+
 // Parase the lights
 Light Raytracer::parseLightNode(json const &node) const {
   Point pos(node["position"]);
@@ -93,7 +208,9 @@ Light Raytracer::parseLightNode(json const &node) const {
   return Light(pos, col);
 }
 
-Material Raytracer::parseMaterialNode(json const &node) const {
+// A material with a texture gets it once the texture is loaded, see
+// loadAssets
+void Raytracer::parseMaterialNode(json const &node, Material &material) {
   auto textureLoc = node.find("texture");
   auto colorLoc = node.find("color");
 
@@ -105,30 +222,24 @@ Material Raytracer::parseMaterialNode(json const &node) const {
   // Parse the texture or color if either exists
   if (textureLoc != node.end()) {
     string itname = *textureLoc;
-    Texture texture(itname);
-    return Material(texture, ka, kd, ks, n);
+    material = Material(TexturePtr(), ka, kd, ks, n);
+    unloadedTextures[itname].push_back(&material);
   } else if (colorLoc != node.end()) {
     Color color(*colorLoc);
-    return Material(color, ka, kd, ks, n);
+    material = Material(color, ka, kd, ks, n);
   } else {
     throw runtime_error("No texture or color specified for material.");
   }
 }
 
-bool Raytracer::readScene(string const &ifname) try {
-  // Read and parse input json file
-  ifstream infile(ifname);
-  if (!infile)
-    throw runtime_error("Could not open input file for reading.");
-  json jsonscene;
-  infile >> jsonscene;
-
-  // =============================================================================
-  // -- Read your scene data in this section
-  // -------------------------------------
-  // =============================================================================
+void Raytracer::setTextureMemory(size_t megabytes) {
+  textureMemory = megabytes;
+  textureMemoryFixed = true;
+}
 
-  Point eye(jsonscene["Eye"]);
+// The eye and the settings of the scene, given as in a .json scene file
+void Raytracer::parseSettings(json const &jsonscene) {
+  Point eye(jsonscene.at("Eye"));
   scene.setEye(eye);
 
   // Parse the shadow boolean and set
@@ -154,13 +265,113 @@ bool Raytracer::readScene(string const &ifname) try {
     scene.setRecursionFactor(*recursionFactor);
   }
 
+  // Parse the number of primary rays traced together and set
+  auto packetSize = jsonscene.find("PacketSize");
+  if (packetSize != jsonscene.end()) {
+    cout << "Packet size set to " << *packetSize << ".\n";
+    unsigned size = *packetSize;
+    if (size != 1 && size != 4 && size != 8 && size != 16)
+      throw runtime_error("Packet size must be 1, 4, 8 or 16.");
+    scene.setPacketSize(size);
+  }
+
+  // Parse the breadth first rendering boolean and set
+  auto wavefront = jsonscene.find("Wavefront");
+  if (wavefront != jsonscene.end()) {
+    cout << "Wavefront set to " << *wavefront << ".\n";
+    scene.setWavefront(*wavefront);
+  }
+
+  // Parse the texture filter and set
+  auto textureFilter = jsonscene.find("TextureFilter");
+  if (textureFilter != jsonscene.end()) {
+    cout << "Texture filter set to " << *textureFilter << ".\n";
+    scene.setTextureFilter(parseTextureFilter(*textureFilter));
+  }
+
+  // Parse the mesh cache settings and set
+  auto meshCache = jsonscene.find("MeshCache");
+  if (meshCache != jsonscene.end()) {
+    cout << "Mesh cache set to " << *meshCache << ".\n";
+    useMeshCache = *meshCache;
+  }
+  auto meshCacheDir = jsonscene.find("MeshCacheDirectory");
+  if (meshCacheDir != jsonscene.end()) {
+    cout << "Mesh cache directory set to " << *meshCacheDir << ".\n";
+    meshCacheDirectory = meshCacheDir->get<string>();
+  }
+
+  // Parse the texture cache settings and set
+  auto textureCache = jsonscene.find("TextureCache");
+  if (textureCache != jsonscene.end()) {
+    cout << "Texture cache set to " << *textureCache << ".\n";
+    useTextureCache = *textureCache;
+  }
+  auto textureCacheDir = jsonscene.find("TextureCacheDirectory");
+  if (textureCacheDir != jsonscene.end()) {
+    cout << "Texture cache directory set to " << *textureCacheDir << ".\n";
+    textureCacheDirectory = textureCacheDir->get<string>();
+  }
+  auto textureMemoryNode = jsonscene.find("TextureMemory");
+  if (textureMemoryNode != jsonscene.end() && !textureMemoryFixed) {
+    cout << "Texture memory set to " << *textureMemoryNode << " MiB.\n";
+    // As on the command line, and small enough to count in bytes
+    if (!textureMemoryNode->is_number_integer() || *textureMemoryNode <= 0 ||
+        textureMemoryNode->get<uint64_t>() > (SIZE_MAX >> 20))
+      throw runtime_error("Texture memory must be a positive number of MiB.");
+    textureMemory = *textureMemoryNode;
+  }
+  if (useTextureCache)
+    TextureStore::instance().setCache(textureCacheDirectory,
+                                      textureMemory << 20);
+
+  // Parse the acceleration structure and set
+  auto accelerator = jsonscene.find("Accelerator");
+  if (accelerator != jsonscene.end()) {
+    cout << "Accelerator set to " << *accelerator << ".\n";
+    scene.setAccelerator(parseAccelerator(*accelerator));
+  }
+}
+
+// Read the input json file as a stream, so a scene with many objects is
+// never held as json as a whole. Everything but the objects is small and read
+// first, wherever it is in the file, as the settings apply to the objects.
+// Then the objects are read and added to the scene one by one.
+size_t Raytracer::readJsonScene(string const &ifname) {
+  JsonReader reader(ifname);
+  json jsonscene = json::object();
+  size_t objectsOffset = 0;
+  bool hasObjects = false;
+  string key;
+  reader.beginObject();
+  while (reader.nextKey(key)) {
+    if (key == "Objects") {
+      objectsOffset = reader.offset();
+      hasObjects = true;
+      reader.skip();
+    } else {
+      jsonscene[key] = reader.value();
+    }
+  }
+
+  // =============================================================================
+  // -- Read your scene data in this section
+  // -------------------------------------
+  // =============================================================================
+
+  parseSettings(jsonscene);
+
   for (auto const &lightNode : jsonscene["Lights"])
     scene.addLight(parseLightNode(lightNode));
 
   unsigned objCount = 0;
-  for (auto const &objectNode : jsonscene["Objects"])
-    if (parseObjectNode(objectNode))
-      ++objCount;
+  if (hasObjects) {
+    reader.seek(objectsOffset);
+    reader.beginArray();
+    while (reader.nextElement())
+      if (parseObjectNode(reader.value()))
+        ++objCount;
+  }
 
   cout << "Parsed " << objCount << " objects.\n";
 
@@ -169,6 +380,99 @@ bool Raytracer::readScene(string const &ifname) try {
   // ------------------------------------------------
   // =============================================================================
 
+  return reader.size();
+}
+
+// Read a binary scene (see binaryscene.h) from its mapping. Its settings are
+// few and go through parseSettings like those of a .json file, the lights,
+// materials and objects are read from their records straight into the scene.
+size_t Raytracer::readBinaryScene(string const &ifname) {
+  BinaryScene file(ifname);
+  BinaryScene::Header const &header = file.header();
+  parseSettings(file.settings());
+
+  for (size_t idx = 0; idx != header.numLights; ++idx) {
+    BinaryScene::Light const &light = file.lights()[idx];
+    scene.addLight(Light(
+        Point(light.position[0], light.position[1], light.position[2]),
+        Color(light.color[0], light.color[1], light.color[2])));
+  }
+
+  // The objects share the materials, which are stored once. Those with a
+  // texture get it once it is loaded, see loadAssets.
+  vector<Material> materials;
+  vector<vector<Material *> *> textureUsers(header.numMaterials, nullptr);
+  for (size_t idx = 0; idx != header.numMaterials; ++idx) {
+    BinaryScene::Material const &material = file.materials()[idx];
+    if (material.texture != BinaryScene::NONE) {
+      materials.push_back(Material(TexturePtr(), material.ka, material.kd,
+                                   material.ks, material.n));
+      textureUsers[idx] = &unloadedTextures[file.text(material.texture)];
+    } else {
+      materials.push_back(Material(
+          Color(material.color[0], material.color[1], material.color[2]),
+          material.ka, material.kd, material.ks, material.n));
+    }
+  }
+
+  for (size_t idx = 0; idx != header.numObjects; ++idx) {
+    BinaryScene::Object const &object = file.objects()[idx];
+    double const *values = object.values;
+    Point first(values[0], values[1], values[2]);
+    Point second(values[3], values[4], values[5]);
+
+    ObjectPtr obj;
+    switch (object.type) {
+    case BinaryScene::SPHERE:
+      obj = ObjectPtr(new Sphere(first, values[3]));
+      break;
+    case BinaryScene::TRIANGLE:
+      obj = ObjectPtr(new Triangle(first, second,
+                                   Point(values[6], values[7], values[8])));
+      break;
+    case BinaryScene::MESH:
+      obj = placeMesh(file.text(object.model), first, values[3]);
+      break;
+    case BinaryScene::PLANE:
+      obj = ObjectPtr(new Plane(first, second));
+      break;
+    case BinaryScene::CYLINDER:
+      obj = ObjectPtr(new Cylinder(first, second, values[6]));
+      break;
+    }
+
+    if (object.flags & BinaryScene::ROTATED)
+      obj->setRotation(Vector(values[4], values[5], values[6]), values[7]);
+    obj->material = materials[object.material];
+    if (textureUsers[object.material])
+      textureUsers[object.material]->push_back(&obj->material);
+    scene.addObject(obj);
+  }
+
+  cout << "Parsed " << header.numObjects << " objects.\n";
+  return file.size();
+}
+
+bool Raytracer::readScene(string const &ifname) try {
+  auto start = chrono::steady_clock::now();
+  size_t size = BinaryScene::matches(ifname) ? readBinaryScene(ifname)
+                                             : readJsonScene(ifname);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "Reading the scene took " << elapsed.count() << " seconds ("
+       << size / 1e6 / elapsed.count() << " MB/s).\n";
+
+  start = chrono::steady_clock::now();
+  loadAssets();
+  elapsed = chrono::steady_clock::now() - start;
+  cout << "Loading models and textures took " << elapsed.count()
+       << " seconds.\n";
+
+  start = chrono::steady_clock::now();
+  scene.buildAccelerator();
+  elapsed = chrono::steady_clock::now() - start;
+  cout << "Building the acceleration structure took " << elapsed.count()
+       << " seconds.\n";
+
   return true;
 } catch (exception const &ex) {
   cerr << ex.what() << '\n';
@@ -179,7 +483,18 @@ void Raytracer::renderToFile(string const &ofname) {
   // TODO: the size may be a settings in your file
   Image img(400, 400);
   cout << "Tracing...\n";
+  auto start = chrono::steady_clock::now();
   scene.render(img);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  double primaryRays = double(img.width()) * img.height() *
+                       scene.samplesPerPixel();
+  cout << "Tracing took " << elapsed.count() << " seconds ("
+       << primaryRays / elapsed.count() << " primary rays per second).\n";
+  auto tiles = TextureStore::instance().tileCache();
+  if (tiles && tiles->pagesRead() != 0)
+    cout << "Read " << tiles->pagesRead() * TileCache::PAGE_SIZE / 1024
+         << " KiB of texture pages into a tile cache of "
+         << tiles->budget() / 1024 << " KiB.\n";
   cout << "Writing image to " << ofname << "...\n";
   img.write_png(ofname);
   cout << "Done.\n";
@@ -2,27 +2,66 @@
 #define RAYTRACER_H_
 
 #include "scene.h"
+#include "shapes/meshgeometry.h"
 
+#include <map>
 #include <string>
+#include <vector>
 
 // Forward declerations
 class Light;
 class Material;
+class Mesh;
 
 #include "json/json_fwd.h"
 
 class Raytracer {
   Scene scene;
 
+  // Models loaded so far, each file is shared by all meshes using it
+  std::map<std::string, MeshGeometryPtr> meshes;
+
+  // Meshes and materials read before their model or texture was loaded, by
+  // the file. The files are loaded together once all objects are read, see
+  // loadAssets.
+  std::map<std::string, std::vector<Mesh *>> unloadedMeshes;
+  std::map<std::string, std::vector<Material *>> unloadedTextures;
+
+  // Models are cached on disk, see meshcache.h
+  bool useMeshCache = true;
+  std::string meshCacheDirectory = ".meshcache";
+
+  // If enabled, textures are cached on disk and read through a tile cache
+  // of at most textureMemory MiB, see texturecache.h. Off by default, as
+  // sampling through the tile cache is slower for textures which fit in
+  // memory anyway.
+  bool useTextureCache = false;
+  std::string textureCacheDirectory = ".texturecache";
+  size_t textureMemory = 256;
+  bool textureMemoryFixed = false; // set on the command line
+
 public:
+  // The memory of the tile cache in MiB, overriding the scene file
+  void setTextureMemory(size_t megabytes);
+
   bool readScene(std::string const &ifname);
   void renderToFile(std::string const &ofname);
 
 private:
+  void parseSettings(nlohmann::json const &jsonscene);
+  size_t readJsonScene(std::string const &ifname);   // returns the file size
+  size_t readBinaryScene(std::string const &ifname); // returns the file size
+
   bool parseObjectNode(nlohmann::json const &node);
+  ObjectPtr placeMesh(std::string const &filename, Vector const &translation,
+                      double scale);
+  MeshGeometryPtr readMesh(std::string const &filename) const;
+  void loadAssets();
 
+  AcceleratorPtr parseAccelerator(nlohmann::json const &node) const;
+  Texture::Filter parseTextureFilter(nlohmann::json const &node) const;
   Light parseLightNode(nlohmann::json const &node) const;
-  Material parseMaterialNode(nlohmann::json const &node) const;
+  void parseMaterialNode(nlohmann::json const &node, Material &material);
 };
 
 #endif
@@ -1,72 +1,227 @@
 #include "scene.h"
 
+#include "accelerators/bvhaccelerator.h"
 #include "hit.h"
 #include "image.h"
 #include "material.h"
 #include "ray.h"
+#include "wavefront.h"
 
+#include <algorithm>
 #include <cmath>
-#include <limits>
+#include <iostream>
+#include <omp.h>
 
 using namespace std;
 
-Color Scene::trace(Ray const &ray, int depth) {
+namespace {
+// Width and height in pixels of the tiles rendered with packets
+unsigned const TILE_SIZE = 4;
+} // namespace
+
+Color Scene::trace(Ray const &ray, RayDifferentials const &differentials,
+                   int depth) {
   // If we have reached the final impact already, return black
   if (depth < 1) {
     return Color(0.0, 0.0, 0.0);
   }
 
   // Find hit object and distance
-  Hit min_hit(numeric_limits<double>::infinity(), Vector());
-  ObjectPtr obj = nullptr;
-  for (unsigned idx = 0; idx != objects.size(); ++idx) {
-    Hit hit(objects[idx]->intersect(ray));
-    if (hit.t < min_hit.t) {
-      min_hit = hit;
-      obj = objects[idx];
-    }
-  }
+  Hit min_hit(ray.tmax, Vector());
+  ObjectPtr obj = closestHit(ray, min_hit);
 
   // No hit? Return background color.
   if (!obj)
     return Color(0.0, 0.0, 0.0);
 
   // Get color of impact
-  return getColor(ray, obj, min_hit, depth);
+  return getColor(ray, differentials, obj, min_hit, depth);
+}
+
+// Finds the closest object hit by the ray, hit is updated accordingly.
+// The ray is copied as its interval shrinks to the closest hit found so far.
+ObjectPtr Scene::closestHit(Ray ray, Hit &hit) {
+  ObjectPtr obj = nullptr;
+
+  // Planes and such are not part of the hierarchy
+  for (auto const &object : unbounded) {
+    Hit objectHit(object->intersect(ray));
+    if (ray.contains(objectHit.t)) {
+      ray.tmax = objectHit.t;
+      hit = objectHit;
+      obj = object;
+    }
+  }
+
+  ObjectPtr bounded = accelerator->intersect(ray, hit);
+  return bounded ? bounded : obj;
+}
+
+// Closest hits of a packet of primary rays, like closestHit on each of them.
+// Unlike there, the intervals of the rays shrink to their closest hit.
+void Scene::closestHits(Ray *rays, Hit *hits, ObjectPtr *objs,
+                        unsigned count) {
+  // Planes and such are not part of the hierarchy
+  for (unsigned idx = 0; idx != count; ++idx) {
+    for (auto const &object : unbounded) {
+      Hit objectHit(object->intersect(rays[idx]));
+      if (rays[idx].contains(objectHit.t)) {
+        rays[idx].tmax = objectHit.t;
+        hits[idx] = objectHit;
+        objs[idx] = object;
+      }
+    }
+  }
+
+  accelerator->intersectPacket(rays, hits, objs, count);
 }
 
 void Scene::render(Image &img) {
-  unsigned w = img.width();
-  unsigned h = img.height();
+  shadowCaches.assign(omp_get_max_threads(), ShadowCache());
+  for (ShadowCache &cache : shadowCaches)
+    cache.occluders.assign(lights.size(), nullptr);
+
+  if (wavefront)
+    Wavefront(*this).render(img);
+  else if (packetSize > 1)
+    renderPackets(img);
+  else
+    renderRays(img);
+
+  if (renderShadows) {
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    unsigned long unblocked = 0;
+    for (ShadowCache const &cache : shadowCaches) {
+      hits += cache.hits;
+      misses += cache.misses;
+      unblocked += cache.unblocked;
+    }
+    cout << "Shadow cache: " << hits << " hits, " << misses << " misses ("
+         << (hits + misses == 0 ? 0.0 : 100.0 * hits / (hits + misses))
+         << "% of blocked shadow rays), " << unblocked
+         << " shadow rays reached the light.\n";
+  }
+  shadowCaches.clear();
+}
 
+// Appends the primary rays through pixel (x, y) to rays, in the order in
+// which their colors are summed
+void Scene::primaryRays(unsigned x, unsigned y, unsigned h,
+                        vector<Ray> &rays) const {
   int factor = ssFactor;
   double subPixelSize = 1.0 / (2 * factor);
 
-#pragma omp parallel for
-  for (unsigned y = 0; y < h; ++y) {
-    for (unsigned x = 0; x < w; ++x) {
-
-      // Apply super sampling
-      // Average the color over the samples
-      Color col(0., 0., 0.);
-      for (int i = -factor / 2; i <= factor / 2; ++i) {
-        for (int j = -factor / 2; j <= factor / 2; ++j) {
-          // If there is more than one pixel, the 0 crossings should be skipped
-          if (factor != 1 && (i == 0 || j == 0))
-            continue;
-
-          // Determine coordinates of sample
-          Point pixel(x + 0.5 + (subPixelSize * i),
-                      h - 1 - y + 0.5 + (subPixelSize * j), 0);
-          Ray ray(eye, (pixel - eye).normalized());
-          // Collect color of samples
-          col += trace(ray, recursionDepth);
-        }
+  // Apply super sampling
+  for (int i = -factor / 2; i <= factor / 2; ++i) {
+    for (int j = -factor / 2; j <= factor / 2; ++j) {
+      // If there is more than one pixel, the 0 crossings should be skipped
+      if (factor != 1 && (i == 0 || j == 0))
+        continue;
+
+      // Determine coordinates of sample
+      Point pixel(x + 0.5 + (subPixelSize * i),
+                  h - 1 - y + 0.5 + (subPixelSize * j), 0);
+      rays.push_back(Ray(eye, (pixel - eye).normalized()));
+    }
+  }
+}
+
+// How the direction of a primary ray changes from one sample to the next.
+// The pixels lie on the plane z = 0, one unit apart.
+RayDifferentials Scene::primaryDifferentials(Ray const &ray) const {
+  RayDifferentials differentials;
+  double distance = -eye.z / ray.D.z; // from the eye to the pixel
+  if (!(distance > 0.0) || std::isinf(distance))
+    return differentials;
+
+  double spacing = 1.0 / sqrt(samplesPerPixel()) / distance;
+  Vector X(1.0, 0.0, 0.0);
+  Vector Y(0.0, 1.0, 0.0);
+  differentials.dDdx = (X - ray.D.dot(X) * ray.D) * spacing;
+  differentials.dDdy = (Y - ray.D.dot(Y) * ray.D) * spacing;
+  return differentials;
+}
+
+// Traces every ray on its own
+void Scene::renderRays(Image &img) {
+  unsigned w = img.width();
+  unsigned h = img.height();
+
+#pragma omp parallel
+  {
+    vector<Ray> rays;
+
+#pragma omp for
+    for (unsigned y = 0; y < h; ++y) {
+      for (unsigned x = 0; x < w; ++x) {
+        rays.clear();
+        primaryRays(x, y, h, rays);
+
+        // Average the color over the samples
+        Color col(0., 0., 0.);
+        for (Ray const &ray : rays)
+          col += trace(ray, primaryDifferentials(ray), recursionDepth);
+        col /= ssFactor * ssFactor; // Average the colors over the samples
+
+        col.clamp();
+        img.put_pixel(x, y, col);
       }
-      col /= ssFactor * ssFactor; // Average the colors over the samples
+    }
+  }
+}
 
-      col.clamp();
-      img(x, y) = col;
+// Traces the primary rays of a tile of pixels in packets of packetSize
+// rays. The bounces from their hits are traced one by one, as those rays
+// are too incoherent to share a packet.
+void Scene::renderPackets(Image &img) {
+  unsigned w = img.width();
+  unsigned h = img.height();
+  unsigned tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+
+#pragma omp parallel
+  {
+    vector<Ray> rays;
+    vector<Hit> hits;
+    vector<ObjectPtr> objs;
+
+#pragma omp for schedule(dynamic)
+    for (unsigned tile = 0; tile < tilesX * tilesY; ++tile) {
+      unsigned x0 = tile % tilesX * TILE_SIZE;
+      unsigned y0 = tile / tilesX * TILE_SIZE;
+      unsigned x1 = min(w, x0 + TILE_SIZE);
+      unsigned y1 = min(h, y0 + TILE_SIZE);
+
+      rays.clear();
+      for (unsigned y = y0; y != y1; ++y)
+        for (unsigned x = x0; x != x1; ++x)
+          primaryRays(x, y, h, rays);
+
+      hits.assign(rays.size(), Hit::NO_HIT());
+      objs.assign(rays.size(), nullptr);
+      if (recursionDepth >= 1) {
+        for (unsigned first = 0; first < rays.size(); first += packetSize)
+          closestHits(&rays[first], &hits[first], &objs[first],
+                      min<size_t>(packetSize, rays.size() - first));
+      }
+
+      unsigned samples = rays.size() / ((x1 - x0) * (y1 - y0));
+      unsigned sample = 0;
+      for (unsigned y = y0; y != y1; ++y) {
+        for (unsigned x = x0; x != x1; ++x) {
+          // Average the color over the samples
+          Color col(0., 0., 0.);
+          for (unsigned idx = 0; idx != samples; ++idx, ++sample)
+            if (objs[sample])
+              col += getColor(rays[sample], primaryDifferentials(rays[sample]),
+                              objs[sample], hits[sample], recursionDepth);
+          col /= ssFactor * ssFactor; // Average the colors over the samples
+
+          col.clamp();
+          img.put_pixel(x, y, col);
+        }
+      }
     }
   }
 }
@@ -75,6 +230,23 @@ void Scene::render(Image &img) {
 
 void Scene::addObject(ObjectPtr obj) { objects.push_back(obj); }
 
+void Scene::buildAccelerator() {
+  if (!accelerator)
+    accelerator = AcceleratorPtr(new BVHAccelerator());
+
+  // Split the objects on whether they fit in an acceleration structure
+  vector<ObjectPtr> bounded;
+  unbounded.clear();
+  for (auto const &obj : objects) {
+    if (obj->boundingBox().isFinite())
+      bounded.push_back(obj);
+    else
+      unbounded.push_back(obj);
+  }
+
+  accelerator->build(bounded);
+}
+
 void Scene::addLight(Light const &light) {
   lights.push_back(LightPtr(new Light(light)));
 }
@@ -83,27 +255,49 @@ void Scene::setEye(Triple const &position) { eye = position; }
 
 void Scene::shouldRenderShadows(bool shadows) { renderShadows = shadows; }
 
-// Checks if the object is in the shadow of another object
-bool Scene::inShadow(Point hit, Vector N, Vector L) {
+// Checks if the object is in the shadow of another object, only objects
+// between the hit and the light (at lightDistance along L) count
+bool Scene::inShadow(Point hit, Vector N, Vector L, double lightDistance,
+                     unsigned light) {
   Point shadowOrigin = hit + (shadowBias * N);
-  Ray shadowRay(shadowOrigin, L);
+  Ray shadowRay(shadowOrigin, L, 0.0, lightDistance);
+
+  // Try the object that blocked this light the last time first (there is no
+  // cache when tracing outside of render)
+  unsigned thread = omp_get_thread_num();
+  ShadowCache *cache =
+      thread < shadowCaches.size() ? &shadowCaches[thread] : nullptr;
+  Object *last = cache ? cache->occluders[light] : nullptr;
+  if (last && last->occluded(shadowRay)) {
+    ++cache->hits;
+    return true;
+  }
 
-  ObjectPtr shadowObject = nullptr;
+  // Forget the cached object when the light is reached, lit pixels tend to
+  // be followed by lit pixels which should not pay for testing it
+  Object *blocker = occluder(shadowRay);
+  if (cache) {
+    cache->occluders[light] = blocker;
+    ++(blocker ? cache->misses : cache->unblocked);
+  }
+  return blocker != nullptr;
+}
 
+// Finds any object blocking the shadow ray
+Object *Scene::occluder(Ray const &shadowRay) {
   // Check if the shadow ray collides with any object going towards the light
-  for (unsigned idx = 0; idx != objects.size(); ++idx) {
-    Hit shadowHit(objects[idx]->intersect(shadowRay));
-    if (shadowHit.t > 0) { // There is a collision
-      return true;
-    }
+  for (auto const &object : unbounded) {
+    if (object->occluded(shadowRay)) // There is a collision
+      return object.get();
   }
-  return false;
+
+  return accelerator->occluder(shadowRay);
 }
 
 // Returns a color at an intersection with an object
-Color Scene::getColor(Ray const &ray, ObjectPtr obj, Hit const &intersection,
-                      int depth) {
-  Material material = obj->material; // the hit objects material
+Color Scene::getColor(Ray const &ray, RayDifferentials const &differentials,
+                      ObjectPtr obj, Hit const &intersection, int depth) {
+  Material const &material = obj->material; // the hit objects material
 
   Point hit = ray.at(intersection.t); // the hit point
   Vector N = intersection.N;          // the normal at hit point
@@ -127,58 +321,119 @@ Color Scene::getColor(Ray const &ray, ObjectPtr obj, Hit const &intersection,
   Vector NHat = N.normalized(); // Normalized N
   Vector VHat = V.normalized(); // Normalized V
 
-  // We add an extra scale factor for us to universally adjust if needed
-  const float AMBIENT_LIGHT_INTENSITY = 1.0;
-
   // Return either the color or texture depending on material type
-  Color materialColor = material.surface.match(
-      [=](Color materialColor) { return materialColor; },
-      [=](Texture &materialTexture) {
-        auto coordinates = obj->textureCoordinates(hit);
-
-        return materialTexture.colorAt(coordinates.u, coordinates.v);
-      });
+  Vector dPdx, dPdy; // the footprint of the ray at the hit
+  differentials.transfer(ray, intersection.t, N, dPdx, dPdy);
+  Color materialColor = surfaceColor(obj.get(), material, hit, dPdx, dPdy);
 
   // Add the ambient component
-  Color color = material.ka * AMBIENT_LIGHT_INTENSITY * materialColor;
+  Color color = ambientTerm(material, materialColor);
 
   // For each light
-  for (auto lightPtr : lights) {
+  for (unsigned light = 0; light != lights.size(); ++light) {
+    LightPtr const &lightPtr = lights[light];
+
     // Create vector to light
     Vector L = (lightPtr->position - hit).normalized();
+    double lightDistance = (lightPtr->position - hit).length();
 
     // If the impact is in shadow, then the light does not contribute.
-    if (renderShadows && inShadow(hit, N, L))
+    if (renderShadows && inShadow(hit, N, L, lightDistance, light))
       continue;
 
-    // Diffuse term
-    float NdotL = NHat.dot(L);
-    float intensity = max(min(NdotL, 1.0f), 0.0f);
-    color += material.kd * intensity * materialColor * (lightPtr->color);
-
-    // Specular term
-    Vector R = (2 * (NdotL)*NHat - L).normalized();
-    float VdotR = VHat.dot(R);
-    intensity = pow(max(min(VdotR, 1.0f), 0.0f), material.n);
-    color += material.ks * intensity * (lightPtr->color);
+    Color diffuse, specular;
+    lightTerms(material, materialColor, NHat, VHat, L, *lightPtr, diffuse,
+               specular);
+    color += diffuse;
+    color += specular;
   }
 
-  // Create the reflection ray for recursive reflection
-  Vector reflectionDirection = ray.D - N * 2.0 * ray.D.dot(N);
-  Point reflectionOrigin = hit + (N * reflectionBias); // Bias
-  Ray reflectionRay(reflectionOrigin, reflectionDirection);
-
   // Return the light at the current hit, plus the light being reflected onto
   // this hit
-  color += material.ks * trace(reflectionRay, depth - 1);
+  color += material.ks * trace(reflectionRay(ray, hit, N),
+                               differentials.reflect(ray, intersection.t, N),
+                               depth - 1);
 
   return color;
 }
 
+// The color of the material of obj at the point hit, with differentials
+// dPdx and dPdy to the hits of the neighbouring samples
+Color Scene::surfaceColor(Object *obj, Material const &material,
+                          Point const &hit, Vector const &dPdx,
+                          Vector const &dPdy) const {
+  return material.surface.match(
+      [](Color const &materialColor) { return materialColor; },
+      [&](TexturePtr const &materialTexture) {
+        auto coordinates = obj->textureCoordinates(hit);
+        if (textureFilter == Texture::NEAREST)
+          return materialTexture->colorAt(coordinates.u, coordinates.v);
+
+        // The footprint in texture space, u wraps around (e.g. spheres)
+        TextureCoordinates dx = obj->textureCoordinates(hit + dPdx);
+        TextureCoordinates dy = obj->textureCoordinates(hit + dPdy);
+        for (TextureCoordinates *d : {&dx, &dy}) {
+          d->u -= coordinates.u;
+          d->v -= coordinates.v;
+          d->u -= round(d->u);
+        }
+        return materialTexture->sample(coordinates, dx, dy, textureFilter);
+      });
+}
+
+Color Scene::ambientTerm(Material const &material,
+                         Color const &materialColor) const {
+  // We add an extra scale factor for us to universally adjust if needed
+  const float AMBIENT_LIGHT_INTENSITY = 1.0;
+
+  return material.ka * AMBIENT_LIGHT_INTENSITY * materialColor;
+}
+
+// The diffuse and specular light reflected towards V (the view vector) when
+// light reaches the surface from direction L (all normalized)
+void Scene::lightTerms(Material const &material, Color const &materialColor,
+                       Vector const &NHat, Vector const &VHat,
+                       Vector const &L, Light const &light, Color &diffuse,
+                       Color &specular) const {
+  // Diffuse term
+  float NdotL = NHat.dot(L);
+  float intensity = max(min(NdotL, 1.0f), 0.0f);
+  diffuse = material.kd * intensity * materialColor * (light.color);
+
+  // Specular term
+  Vector R = (2 * (NdotL)*NHat - L).normalized();
+  float VdotR = VHat.dot(R);
+  intensity = pow(max(min(VdotR, 1.0f), 0.0f), material.n);
+  specular = material.ks * intensity * (light.color);
+}
+
+// Create the reflection ray for recursive reflection
+Ray Scene::reflectionRay(Ray const &ray, Point const &hit,
+                         Vector const &N) const {
+  Vector reflectionDirection = ray.D - N * 2.0 * ray.D.dot(N);
+  Point reflectionOrigin = hit + (N * reflectionBias); // Bias
+  return Ray(reflectionOrigin, reflectionDirection);
+}
+
 unsigned Scene::getNumObject() { return objects.size(); }
 
 void Scene::setSuperSamplingFactor(unsigned int factor) { ssFactor = factor; }
 
 void Scene::setRecursionFactor(unsigned int depth) { recursionDepth = depth; }
 
+void Scene::setPacketSize(unsigned int size) { packetSize = size; }
+
+void Scene::setWavefront(bool wavefront) { this->wavefront = wavefront; }
+
+void Scene::setTextureFilter(Texture::Filter filter) { textureFilter = filter; }
+
+unsigned Scene::samplesPerPixel() const {
+  unsigned perAxis = ssFactor == 1 ? 1 : 2 * (ssFactor / 2);
+  return perAxis * perAxis;
+}
+
+void Scene::setAccelerator(AcceleratorPtr accelerator) {
+  this->accelerator = move(accelerator);
+}
+
 unsigned Scene::getNumLights() { return lights.size(); }
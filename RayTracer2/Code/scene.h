@@ -1,6 +1,8 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "accelerators/accelerator.h"
+#include "alignedallocator.h"
 #include "light.h"
 #include "object.h"
 #include "triple.h"
@@ -9,6 +11,7 @@
 
 // Forward declerations
 class Ray;
+struct RayDifferentials;
 class Image;
 
 class Scene {
@@ -16,33 +19,82 @@ class Scene {
   std::vector<LightPtr> lights; // no ptr needed, but kept for consistency
   Point eye;
 
+  // Acceleration structure, see buildAccelerator()
+  AcceleratorPtr accelerator;       // holds the objects with finite bounds
+  std::vector<ObjectPtr> unbounded; // objects tested against every ray
+
+  // Per render thread, the object that last blocked each light. Neighbouring
+  // pixels tend to be shadowed by the same object, so it is tried first.
+  struct alignas(64) ShadowCache {
+    std::vector<Object *> occluders; // indexed by light
+    unsigned long hits = 0;      // the cached object blocked the light
+    unsigned long misses = 0;    // another object blocked the light
+    unsigned long unblocked = 0; // nothing blocked the light
+  };
+  std::vector<ShadowCache, AlignedAllocator<ShadowCache, 64>> shadowCaches;
+
   // Additional configuration
   bool renderShadows = false;
   double shadowBias = 0.00001;
   double reflectionBias = 0.00000000001;
   unsigned int ssFactor = 1;
   unsigned int recursionDepth = 1;
+  unsigned int packetSize = 16; // primary rays traced together, 1 for none
+  bool wavefront = false;       // render breadth first, see Wavefront
+  Texture::Filter textureFilter = Texture::ANISOTROPIC;
 
 public:
-  // trace a ray into the scene and return the color
-  Color trace(Ray const &ray, int depth);
+  // trace a ray into the scene and return the color, the differentials of
+  // the ray select the level of detail of the textures it hits
+  Color trace(Ray const &ray, RayDifferentials const &differentials,
+              int depth);
 
   // render the scene to the given image
   void render(Image &img);
 
+  // build the acceleration structure over the objects, must be called after
+  // the objects have been added and before rendering
+  void buildAccelerator();
+
   void addObject(ObjectPtr obj);
   void addLight(Light const &light);
   void setEye(Triple const &position);
   void shouldRenderShadows(bool shadows);
   void setSuperSamplingFactor(unsigned int factor);
   void setRecursionFactor(unsigned int depth);
+  void setAccelerator(AcceleratorPtr accelerator); // a BVH by default
+  void setPacketSize(unsigned int size);
+  void setWavefront(bool wavefront);
+  void setTextureFilter(Texture::Filter filter);
+
+  unsigned samplesPerPixel() const; // primary rays per pixel
 
   unsigned getNumObject();
   unsigned getNumLights();
 
 private:
-  Color getColor(Ray const &ray, ObjectPtr obj, Hit const &hit, int depth);
-  bool inShadow(Point hit, Vector N, Vector L);
+  friend class Wavefront;
+
+  ObjectPtr closestHit(Ray ray, Hit &hit);
+  void closestHits(Ray *rays, Hit *hits, ObjectPtr *objs, unsigned count);
+  void primaryRays(unsigned x, unsigned y, unsigned h,
+                   std::vector<Ray> &rays) const;
+  RayDifferentials primaryDifferentials(Ray const &ray) const;
+  void renderRays(Image &img);
+  void renderPackets(Image &img);
+  Color getColor(Ray const &ray, RayDifferentials const &differentials,
+                 ObjectPtr obj, Hit const &hit, int depth);
+  Color surfaceColor(Object *obj, Material const &material, Point const &hit,
+                     Vector const &dPdx, Vector const &dPdy) const;
+  Color ambientTerm(Material const &material,
+                    Color const &materialColor) const;
+  void lightTerms(Material const &material, Color const &materialColor,
+                  Vector const &NHat, Vector const &VHat, Vector const &L,
+                  Light const &light, Color &diffuse, Color &specular) const;
+  Ray reflectionRay(Ray const &ray, Point const &hit, Vector const &N) const;
+  bool inShadow(Point hit, Vector N, Vector L, double lightDistance,
+                unsigned light);
+  Object *occluder(Ray const &shadowRay);
 };
 
 #endif
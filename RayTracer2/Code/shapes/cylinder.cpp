@@ -82,6 +82,20 @@ TextureCoordinates Cylinder::textureCoordinates(Point const &point) {
   throw std::logic_error("Not implemented.");
 }
 
+// The caps are disks, along each axis they extend by the radius scaled with
+// the sine of the angle between that axis and the axis of the cylinder
+AABB Cylinder::boundingBox() const {
+  Vector ca = pointB - pointA;
+  double caca = ca.dot(ca);
+  Vector e(radius * sqrt(fmax(0.0, 1.0 - ca.x * ca.x / caca)),
+           radius * sqrt(fmax(0.0, 1.0 - ca.y * ca.y / caca)),
+           radius * sqrt(fmax(0.0, 1.0 - ca.z * ca.z / caca)));
+
+  AABB box(pointA - e, pointA + e);
+  box.extend(AABB(pointB - e, pointB + e));
+  return box;
+}
+
 Cylinder::Cylinder(Point const &pointA, Point const &pointB,
                    double const radius)
     : pointA(pointA), pointB(pointB), radius(radius) {}
@@ -9,6 +9,7 @@ public:
 
   virtual Hit intersect(Ray const &ray);
   virtual TextureCoordinates textureCoordinates(Point const &point);
+  virtual AABB boundingBox() const;
 
   // The cylinder is defined between two points with a radius
   Point const pointA;
@@ -1,52 +1,56 @@
 #include "mesh.h"
 
-#include "../objloader.h"
 #include <cmath>
 
 using namespace std;
 
 Hit Mesh::intersect(Ray const &ray) {
+  Hit hit(geometry->intersect(toModelSpace(ray)));
 
-  Hit min_hit(numeric_limits<double>::infinity(), Vector());
-  bool hit = false;
+  // Uniform scaling leaves the normal alone, only rotate it back
+  if (angle != 0)
+    hit.N = hit.N.rotated(angle, axis);
 
-  // Iterate through each triangle
-  // Looking for the closest hit
-  for (Triangle triangle : triangles) {
+  return hit;
+}
 
-    Hit intersection(triangle.intersect(ray));
-    if (intersection.t < min_hit.t) {
-      min_hit = intersection;
-      hit = true;
-    }
-  }
+bool Mesh::occluded(Ray const &ray) {
+  return geometry->occluded(toModelSpace(ray));
+}
 
-  return hit ? min_hit : Hit::NO_HIT();
+// Bring the ray to model space. The direction is not normalized afterwards,
+// so the distance t, and with it the interval, is the same in both spaces
+Ray Mesh::toModelSpace(Ray const &ray) const {
+  Point origin = (ray.O - translation) / scale;
+  Vector direction = ray.D / scale;
+  if (angle != 0) {
+    origin = origin.rotated(-angle, axis);
+    direction = direction.rotated(-angle, axis);
+  }
+  return Ray(origin, direction, ray.tmin, ray.tmax);
 }
 
 TextureCoordinates Mesh::textureCoordinates(Point const &point) {
   throw std::logic_error("Not implemented.");
 }
 
-Mesh::Mesh(string const &filename, Vector const &translation,
-           double const &scale)
-    : filename(filename), translation(translation), scale(scale) {
-  OBJLoader model(filename);
-  auto vertices = model.vertex_data();
-  for (size_t i = 0; i < model.numTriangles(); i++) {
-    Point vertex1 =
-        (Point(vertices[3 * i].x, vertices[3 * i].y, vertices[3 * i].z) *
-         scale) +
-        translation;
-    Point vertex2 = (Point(vertices[3 * i + 1].x, vertices[3 * i + 1].y,
-                           vertices[3 * i + 1].z) *
-                     scale) +
-                    translation;
-    Point vertex3 = (Point(vertices[3 * i + 2].x, vertices[3 * i + 2].y,
-                           vertices[3 * i + 2].z) *
-                     scale) +
-                    translation;
-    Triangle triangle(vertex1, vertex2, vertex3);
-    triangles.push_back(triangle);
+// Bounds of the transformed corners of the model's bounds
+AABB Mesh::boundingBox() const {
+  AABB model = geometry->bounds();
+  AABB box;
+  for (unsigned corner = 0; corner != 8; ++corner) {
+    Point point(corner & 1 ? model.max.x : model.min.x,
+                corner & 2 ? model.max.y : model.min.y,
+                corner & 4 ? model.max.z : model.min.z);
+    box.extend(point.rotated(angle, axis) * scale + translation);
   }
+  return box;
+}
+
+Mesh::Mesh(MeshGeometryPtr const &geometry, Vector const &translation,
+           double const &scale)
+    : geometry(geometry), translation(translation), scale(scale) {}
+
+void Mesh::setGeometry(MeshGeometryPtr const &geometry) {
+  this->geometry = geometry;
 }
@@ -2,23 +2,29 @@
 #define MESH_H_
 
 #include "../object.h"
-#include "triangle.h"
-#include <string>
-#include <vector>
+#include "meshgeometry.h"
 
+// An instance of a (shared) model, placed in the scene by scaling, rotating
+// (see Object::setRotation) and translating it, in that order.
 class Mesh : public Object {
 public:
-  Mesh(std::string const &filename, Vector const &translation,
+  Mesh(MeshGeometryPtr const &geometry, Vector const &translation,
        double const &scale);
 
+  // For a mesh placed before its model was loaded, see Raytracer::readScene
+  void setGeometry(MeshGeometryPtr const &geometry);
+
   virtual Hit intersect(Ray const &ray);
+  virtual bool occluded(Ray const &ray);
   virtual TextureCoordinates textureCoordinates(Point const &point);
+  virtual AABB boundingBox() const;
 
 private:
-  std::string const &filename;
-  std::vector<Triangle> triangles;
+  MeshGeometryPtr geometry;
   Vector const translation;
   double const scale;
+
+  Ray toModelSpace(Ray const &ray) const;
 };
 
 #endif
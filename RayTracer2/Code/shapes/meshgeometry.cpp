@@ -0,0 +1,64 @@
+#include "meshgeometry.h"
+
+#include "../objloader.h"
+
+using namespace std;
+
+Hit MeshGeometry::intersect(Ray const &ray) {
+  // Walk the hierarchy over the triangles
+  // Looking for the closest hit, nothing beyond the end of the ray
+  double tmax = ray.tmax;
+  unsigned nearest = 0;
+  double u, v;
+  bool hit = false;
+  bvh.intersectLeaves(
+      ray, tmax, [&](unsigned const *indices, unsigned count, double &tmax) {
+        if (triangles.intersect(ray, indices, count, tmax, nearest, u, v))
+          hit = true;
+      });
+  if (!hit)
+    return Hit::NO_HIT();
+
+  // determine orientation of the normal
+  Vector normal = triangles.normal(nearest);
+  if (normal.dot(ray.D) > 0)
+    normal = -normal;
+
+  return Hit(tmax, normal);
+}
+
+bool MeshGeometry::occluded(Ray const &ray) {
+  return bvh.occludedLeaves(
+      ray, ray.tmax, [&](unsigned const *indices, unsigned count) {
+        return triangles.occluded(ray, indices, count, ray.tmax);
+      });
+}
+
+AABB MeshGeometry::bounds() const { return bvh.bounds(); }
+
+size_t MeshGeometry::numTriangles() const { return triangles.size(); }
+
+size_t MeshGeometry::memoryUsage() const {
+  return triangles.memoryUsage() + bvh.memoryUsage();
+}
+
+TriangleArray const &MeshGeometry::getTriangles() const { return triangles; }
+
+BVH4 const &MeshGeometry::getBVH() const { return bvh; }
+
+MeshGeometry::MeshGeometry(TriangleArray const &triangles, BVH4 const &bvh)
+    : triangles(triangles), bvh(bvh) {}
+
+MeshGeometry::MeshGeometry(string const &filename) {
+  vector<float> vertices;
+  vector<unsigned> indices;
+  OBJLoader(filename).indexed_positions(vertices, indices);
+  indices.resize(indices.size() / 3 * 3); // whole triangles
+  triangles.build(move(vertices), move(indices));
+
+  vector<AABB> bounds;
+  bounds.reserve(triangles.size());
+  for (size_t idx = 0; idx != triangles.size(); ++idx)
+    bounds.push_back(triangles.boundingBox(idx));
+  bvh.build(bounds);
+}
@@ -0,0 +1,40 @@
+#ifndef MESHGEOMETRY_H_
+#define MESHGEOMETRY_H_
+
+#include "../bvh4.h"
+#include "../hit.h"
+#include "../ray.h"
+#include "trianglearray.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class MeshGeometry;
+typedef std::shared_ptr<MeshGeometry> MeshGeometryPtr;
+
+// The triangles of a model in model space, together with the hierarchy over
+// them. A model is loaded once and shared by all Mesh objects placing it.
+class MeshGeometry {
+public:
+  explicit MeshGeometry(std::string const &filename);
+  MeshGeometry(TriangleArray const &triangles, BVH4 const &bvh);
+
+  // closest hit with a ray given in model space, within its interval
+  Hit intersect(Ray const &ray);
+  // whether any triangle is hit within the interval of the ray
+  bool occluded(Ray const &ray);
+
+  AABB bounds() const;
+  size_t numTriangles() const;
+  size_t memoryUsage() const; // bytes used by the triangles and hierarchy
+
+  TriangleArray const &getTriangles() const;
+  BVH4 const &getBVH() const;
+
+private:
+  TriangleArray triangles;
+  BVH4 bvh; // hierarchy over the triangles
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "sphere.h"
 #include "solvers.h"
 
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
@@ -27,33 +28,50 @@ Hit Sphere::intersect(Ray const &ray) {
       return Hit::NO_HIT();
   }
 
+  return Hit(t0, normal(ray, t0));
+}
+
+Vector Sphere::normal(Ray const &ray, double t) const {
   // calculate normal
-  Point hit = ray.at(t0);
+  Point hit = ray.at(t);
   Vector N = (hit - position).normalized();
 
   // determine orientation of the normal
   if (N.dot(ray.D) > 0)
     N = -N;
 
-  return Hit(t0, N);
+  return N;
 }
 
-// Rotate the ray around an axis, a certain angle vi
-Triple rotate(Triple const &v, double const angle, Vector const &k) {
-  return v * cos(angle) + (k.cross(v) * sin(angle)) +
-         k * (k.dot(v)) * (1 - cos(angle));
+// Same as intersect, without the normal
+bool Sphere::occluded(Ray const &ray) {
+  Vector L = ray.O - position;
+  double a = ray.D.dot(ray.D);
+  double b = 2 * ray.D.dot(L);
+  double c = L.dot(L) - r * r;
+
+  double t0;
+  double t1;
+  if (!Solvers::quadratic(a, b, c, t0, t1))
+    return false;
+
+  return ray.contains(t0) || ray.contains(t1);
 }
 
 // Find the texture coordinate u,v of a hit on the sphere
 TextureCoordinates Sphere::textureCoordinates(Point const &point) {
   Vector hitVector = point - position;
-  hitVector = rotate(hitVector, angle, axis);
+  hitVector = hitVector.rotated(angle, axis);
 
   TextureCoordinates hitCoordinates;
   hitCoordinates.u = (M_PI + atan2(-hitVector.y, -hitVector.x)) / (2 * M_PI);
-  hitCoordinates.v = acos(hitVector.z / r) / M_PI;
+  hitCoordinates.v = acos(max(-1.0, min(1.0, hitVector.z / r))) / M_PI;
 
   return hitCoordinates;
 }
 
+AABB Sphere::boundingBox() const {
+  return AABB(position - r, position + r);
+}
+
 Sphere::Sphere(Point const &pos, double radius) : position(pos), r(radius) {}
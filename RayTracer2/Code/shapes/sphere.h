@@ -8,7 +8,12 @@ public:
   Sphere(Point const &pos, double radius);
 
   virtual Hit intersect(Ray const &ray);
+  virtual bool occluded(Ray const &ray);
   virtual TextureCoordinates textureCoordinates(Point const &point);
+  virtual AABB boundingBox() const;
+
+  // normal at the hit at distance t along the ray, facing the ray
+  Vector normal(Ray const &ray, double t) const;
 
   Point const position;
   double const r;
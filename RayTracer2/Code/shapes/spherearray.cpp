@@ -0,0 +1,172 @@
+#include "spherearray.h"
+
+#include "solvers.h"
+#include "sphere.h"
+
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+// Slots past the end, such that four slots can always be loaded
+unsigned const PADDING = 3;
+
+#ifdef __SSE2__
+__m128d select(__m128d mask, __m128d a, __m128d b) {
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+// The roots t0 <= t1 of the quadratic of Sphere::intersect for the two
+// spheres at center and radius2, computed in the same order of operations
+// as there and in Solvers::quadratic. NaN when there are none.
+void roots(Ray const &ray, double const *const center[3],
+           double const *radius2, __m128d &t0, __m128d &t1) {
+  __m128d const zero = _mm_setzero_pd();
+  __m128d L[3], D[3];
+  for (int axis = 0; axis != 3; ++axis) {
+    L[axis] = _mm_sub_pd(_mm_set1_pd(ray.O.data[axis]),
+                         _mm_loadu_pd(center[axis]));
+    D[axis] = _mm_set1_pd(ray.D.data[axis]);
+  }
+
+  double a = ray.D.dot(ray.D);
+  __m128d DL = _mm_add_pd(
+      _mm_add_pd(_mm_mul_pd(D[0], L[0]), _mm_mul_pd(D[1], L[1])),
+      _mm_mul_pd(D[2], L[2]));
+  __m128d LL = _mm_add_pd(
+      _mm_add_pd(_mm_mul_pd(L[0], L[0]), _mm_mul_pd(L[1], L[1])),
+      _mm_mul_pd(L[2], L[2]));
+  __m128d b = _mm_mul_pd(_mm_set1_pd(2.0), DL);
+  __m128d c = _mm_sub_pd(LL, _mm_loadu_pd(radius2));
+
+  __m128d discr =
+      _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(_mm_set1_pd(4 * a), c));
+  __m128d root = _mm_sqrt_pd(discr);
+  __m128d half = _mm_set1_pd(-0.5);
+  __m128d q = _mm_mul_pd(half, select(_mm_cmpgt_pd(b, zero),
+                                      _mm_add_pd(b, root),
+                                      _mm_sub_pd(b, root)));
+  __m128d A = _mm_set1_pd(a);
+  __m128d single = _mm_cmpeq_pd(discr, zero);
+  __m128d both = _mm_div_pd(_mm_mul_pd(half, b), A);
+  __m128d x0 = select(single, both, _mm_div_pd(q, A));
+  __m128d x1 = select(single, both, _mm_div_pd(c, q));
+
+  __m128d swap = _mm_cmpgt_pd(x0, x1);
+  __m128d none = _mm_set1_pd(numeric_limits<double>::quiet_NaN());
+  __m128d solved = _mm_cmpge_pd(discr, zero);
+  t0 = select(solved, select(swap, x1, x0), none);
+  t1 = select(solved, select(swap, x0, x1), none);
+}
+
+__m128d contains(Ray const &ray, __m128d t) {
+  return _mm_and_pd(_mm_cmpgt_pd(t, _mm_set1_pd(ray.tmin)),
+                    _mm_cmplt_pd(t, _mm_set1_pd(ray.tmax)));
+}
+#else
+// The roots of the quadratic of Sphere::intersect, NaN when there are none
+void roots(Ray const &ray, Point const &center, double radius2, double &t0,
+           double &t1) {
+  Vector L = ray.O - center;
+  double a = ray.D.dot(ray.D);
+  double b = 2 * ray.D.dot(L);
+  double c = L.dot(L) - radius2;
+  if (!Solvers::quadratic(a, b, c, t0, t1))
+    t0 = t1 = numeric_limits<double>::quiet_NaN();
+}
+#endif
+} // namespace
+
+void SphereArray::build(vector<ObjectPtr> const &objects,
+                        unsigned const *order, size_t count) {
+  for (int axis = 0; axis != 3; ++axis)
+    d_center[axis].assign(count + PADDING, 0.0);
+  d_radius2.assign(count + PADDING, numeric_limits<double>::quiet_NaN());
+
+  for (size_t slot = 0; slot != count; ++slot) {
+    Sphere const *sphere = dynamic_cast<Sphere const *>(
+        objects[order[slot]].get());
+    if (!sphere)
+      continue;
+    for (int axis = 0; axis != 3; ++axis)
+      d_center[axis][slot] = sphere->position.data[axis];
+    d_radius2[slot] = sphere->r * sphere->r;
+  }
+}
+
+bool SphereArray::any(size_t first, unsigned count) const {
+  for (unsigned lane = 0; lane != count; ++lane)
+    if (isSphere(first + lane))
+      return true;
+  return false;
+}
+
+size_t SphereArray::memoryUsage() const {
+  return 4 * d_radius2.size() * sizeof(double);
+}
+
+unsigned SphereArray::intersect(Ray const &ray, size_t first, unsigned count,
+                                double t[4]) const {
+  unsigned mask = 0;
+#ifdef __SSE2__
+  __m128d const zero = _mm_setzero_pd();
+  for (unsigned lane = 0; lane < count; lane += 2) {
+    double const *center[3] = {&d_center[0][first + lane],
+                               &d_center[1][first + lane],
+                               &d_center[2][first + lane]};
+    __m128d t0, t1;
+    roots(ray, center, &d_radius2[first + lane], t0, t1);
+
+    // The nearest root in front of the origin, as Sphere::intersect
+    __m128d nearest = select(_mm_cmplt_pd(t0, zero), t1, t0);
+    __m128d hit = _mm_and_pd(_mm_cmpnlt_pd(nearest, zero),
+                             contains(ray, nearest));
+    _mm_storeu_pd(t + lane, nearest);
+    mask |= _mm_movemask_pd(hit) << lane;
+  }
+#else
+  for (unsigned lane = 0; lane != count; ++lane) {
+    size_t slot = first + lane;
+    double t0, t1;
+    roots(ray, Point(d_center[0][slot], d_center[1][slot], d_center[2][slot]),
+          d_radius2[slot], t0, t1);
+
+    // The nearest root in front of the origin, as Sphere::intersect
+    t[lane] = t0 < 0 ? t1 : t0;
+    if (!(t[lane] < 0) && ray.contains(t[lane]))
+      mask |= 1u << lane;
+  }
+#endif
+  return mask & ((1u << count) - 1);
+}
+
+unsigned SphereArray::occluded(Ray const &ray, size_t first,
+                               unsigned count) const {
+  unsigned mask = 0;
+#ifdef __SSE2__
+  for (unsigned lane = 0; lane < count; lane += 2) {
+    double const *center[3] = {&d_center[0][first + lane],
+                               &d_center[1][first + lane],
+                               &d_center[2][first + lane]};
+    __m128d t0, t1;
+    roots(ray, center, &d_radius2[first + lane], t0, t1);
+    __m128d hit = _mm_or_pd(contains(ray, t0), contains(ray, t1));
+    mask |= _mm_movemask_pd(hit) << lane;
+  }
+#else
+  for (unsigned lane = 0; lane != count; ++lane) {
+    size_t slot = first + lane;
+    double t0, t1;
+    roots(ray, Point(d_center[0][slot], d_center[1][slot], d_center[2][slot]),
+          d_radius2[slot], t0, t1);
+    if (ray.contains(t0) || ray.contains(t1))
+      mask |= 1u << lane;
+  }
+#endif
+  return mask & ((1u << count) - 1);
+}
@@ -0,0 +1,37 @@
+#ifndef SPHEREARRAY_H_
+#define SPHEREARRAY_H_
+
+#include "../object.h"
+#include "../ray.h"
+
+#include <vector>
+
+// The spheres among a list of objects, stored per component in slots in the
+// order of the primitives of a hierarchy (BVH4::indexData), such that the
+// spheres of a leaf are next to each other and a ray is tested against four
+// of them at once. Slots of other objects hold no sphere and are never hit.
+// The hits are the same as those of Sphere::intersect.
+class SphereArray {
+public:
+  // Slots for objects[order[0]], ..., objects[order[count - 1]]
+  void build(std::vector<ObjectPtr> const &objects, unsigned const *order,
+             size_t count);
+
+  bool isSphere(size_t slot) const { return d_radius2[slot] >= 0.0; }
+  bool any(size_t first, unsigned count) const; // any sphere in the slots
+  size_t memoryUsage() const; // bytes used by the components
+
+  // Bitmask of the spheres in slots [first, first + count), at most four,
+  // hit within the interval of the ray. t receives the hits.
+  unsigned intersect(Ray const &ray, size_t first, unsigned count,
+                     double t[4]) const;
+
+  // Bitmask of the spheres hit anywhere within the interval of the ray
+  unsigned occluded(Ray const &ray, size_t first, unsigned count) const;
+
+private:
+  std::vector<double> d_center[3];
+  std::vector<double> d_radius2; // r * r, NaN for slots without a sphere
+};
+
+#endif
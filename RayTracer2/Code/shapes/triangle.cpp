@@ -5,8 +5,6 @@
 
 Hit Triangle::intersect(Ray const &ray) {
   // Möller-Trumbore
-  Vector edge1(v1 - v0);
-  Vector edge2(v2 - v0);
   Vector h = ray.D.cross(edge2);
   double a = edge1.dot(h);
   if (a > -DBL_EPSILON && a < DBL_EPSILON)
@@ -40,11 +38,17 @@ TextureCoordinates Triangle::textureCoordinates(Point const &point) {
   throw std::logic_error("Not implemented.");
 }
 
+AABB Triangle::boundingBox() const {
+  AABB box;
+  box.extend(v0);
+  box.extend(v1);
+  box.extend(v2);
+  return box;
+}
+
 Triangle::Triangle(Point const &v0, Point const &v1, Point const &v2)
-    : v0(v0), v1(v1), v2(v2), N() {
+    : v0(v0), v1(v1), v2(v2), N(), edge1(v1 - v0), edge2(v2 - v0) {
   // Calculate surface normal
-  Vector U(v1 - v0);
-  Vector V(v2 - v0);
-  N = U.cross(V);
+  N = edge1.cross(edge2);
   N.normalize();
 }
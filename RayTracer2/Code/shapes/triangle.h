@@ -9,11 +9,16 @@ public:
 
   virtual Hit intersect(Ray const &ray);
   virtual TextureCoordinates textureCoordinates(Point const &point);
+  virtual AABB boundingBox() const;
 
   Point v0;
   Point v1;
   Point v2;
   Vector N;
+
+private:
+  Vector edge1; // v1 - v0
+  Vector edge2; // v2 - v0
 };
 
 #endif
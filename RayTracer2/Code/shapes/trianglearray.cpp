@@ -0,0 +1,307 @@
+#include "trianglearray.h"
+
+#include <cfloat> // DBL_EPSILON, FLT_EPSILON
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+// Bound on the difference between a sum of products computed in candidates()
+// in single precision and in double precision by intersect(), relative to
+// the sum of the magnitudes of its terms. Each term goes through at most
+// eight roundings of FLT_EPSILON / 2 in single precision (the ray to float,
+// the differences, the products and the sums) and the bound doubles that,
+// which also covers the rounding of the bounds themselves.
+float const ERROR = 16 * FLT_EPSILON / 2;
+
+// The rows of the triangles gathered for the single precision test
+enum Component { V0_X, V0_Y, V0_Z, E1_X, E1_Y, E1_Z, E2_X, E2_Y, E2_Z };
+unsigned const NUM_COMPONENTS = 9;
+
+struct Storage {
+  vector<float> vertices;
+  vector<unsigned> indices;
+};
+} // namespace
+
+void TriangleArray::build(vector<float> &&vertices,
+                          vector<unsigned> &&indices) {
+  shared_ptr<Storage> storage(new Storage{move(vertices), move(indices)});
+  assign(storage->vertices.data(), storage->vertices.size() / 3,
+         storage->indices.data(), storage->indices.size() / 3, storage);
+}
+
+void TriangleArray::assign(float const *vertices, size_t numVertices,
+                           unsigned const *indices, size_t count,
+                           shared_ptr<void const> const &storage) {
+  d_vertices = vertices;
+  d_numVertices = numVertices;
+  d_indices = indices;
+  d_count = count;
+  d_storage = storage;
+}
+
+size_t TriangleArray::memoryUsage() const {
+  return 3 * d_numVertices * sizeof(float) + 3 * d_count * sizeof(unsigned);
+}
+
+// The edges are computed in single precision, which rounds them as storing
+// them in floats would
+void TriangleArray::corners(size_t idx, float v0[3], float edge1[3],
+                            float edge2[3]) const {
+  float const *p0 = d_vertices + 3 * size_t(d_indices[3 * idx]);
+  float const *p1 = d_vertices + 3 * size_t(d_indices[3 * idx + 1]);
+  float const *p2 = d_vertices + 3 * size_t(d_indices[3 * idx + 2]);
+  for (unsigned axis = 0; axis != 3; ++axis) {
+    v0[axis] = p0[axis];
+    edge1[axis] = p1[axis] - p0[axis];
+    edge2[axis] = p2[axis] - p0[axis];
+  }
+}
+
+AABB TriangleArray::boundingBox(size_t idx) const {
+  float v0[3], e1[3], e2[3];
+  corners(idx, v0, e1, e2);
+  Point p0(v0[0], v0[1], v0[2]);
+  AABB box;
+  box.extend(p0);
+  box.extend(p0 + Vector(e1[0], e1[1], e1[2]));
+  box.extend(p0 + Vector(e2[0], e2[1], e2[2]));
+  return box;
+}
+
+Vector TriangleArray::normal(size_t idx) const {
+  float v0[3], e1[3], e2[3];
+  corners(idx, v0, e1, e2);
+  Vector edge1(e1[0], e1[1], e1[2]);
+  Vector edge2(e2[0], e2[1], e2[2]);
+  return edge1.cross(edge2).normalized();
+}
+
+bool TriangleArray::intersect(Ray const &ray, unsigned const *indices,
+                              unsigned count, double &tmax,
+                              unsigned &nearest, double &u, double &v) const {
+  bool hit = false;
+  for (unsigned first = 0; first < count; first += 4) {
+    unsigned lanes = count - first < 4 ? count - first : 4;
+    unsigned mask = candidates(ray, indices + first, lanes, tmax);
+    for (; mask != 0; mask &= mask - 1) {
+      unsigned idx = indices[first + __builtin_ctz(mask)];
+      double hitU, hitV;
+      double t = intersect(ray, idx, hitU, hitV);
+      if (t > ray.tmin && t < tmax) {
+        tmax = t;
+        nearest = idx;
+        u = hitU;
+        v = hitV;
+        hit = true;
+      }
+    }
+  }
+  return hit;
+}
+
+bool TriangleArray::occluded(Ray const &ray, unsigned const *indices,
+                             unsigned count, double tmax) const {
+  for (unsigned first = 0; first < count; first += 4) {
+    unsigned lanes = count - first < 4 ? count - first : 4;
+    unsigned mask = candidates(ray, indices + first, lanes, tmax);
+    for (; mask != 0; mask &= mask - 1) {
+      double u, v;
+      double t = intersect(ray, indices[first + __builtin_ctz(mask)], u, v);
+      if (t > ray.tmin && t < tmax)
+        return true;
+    }
+  }
+  return false;
+}
+
+unsigned TriangleArray::candidates(Ray const &ray, unsigned const *indices,
+                                   unsigned count, double tmax) const {
+  // Gather the triangles, unused lanes repeat the last one
+  alignas(16) float lanes[NUM_COMPONENTS][4];
+  for (unsigned lane = 0; lane != 4; ++lane) {
+    float v0[3], e1[3], e2[3];
+    corners(indices[lane < count ? lane : count - 1], v0, e1, e2);
+    for (unsigned axis = 0; axis != 3; ++axis) {
+      lanes[V0_X + axis][lane] = v0[axis];
+      lanes[E1_X + axis][lane] = e1[axis];
+      lanes[E2_X + axis][lane] = e2[axis];
+    }
+  }
+
+  float O[3], D[3];
+  for (int axis = 0; axis != 3; ++axis) {
+    O[axis] = ray.O.data[axis];
+    D[axis] = ray.D.data[axis];
+  }
+  float limit = tmax < 3e38 ? nextafter(static_cast<float>(tmax),
+                                        numeric_limits<float>::infinity())
+                            : numeric_limits<float>::infinity();
+  unsigned used = (1u << count) - 1;
+
+  // Möller-Trumbore without the division by a: with u = sh / a, v = Dq / a
+  // and t = e2q / a, a triangle is hit if sh, Dq and a - sh - Dq have the
+  // sign of a and e2q / a is at most tmax. Each of the sums is compared with
+  // a margin of ERROR times the sum of the magnitudes of its terms (the
+  // names ending in M below), such that a triangle hit in double precision
+  // is never rejected. A triangle with a within the margin of zero is kept.
+#ifdef __SSE2__
+  __m128 const sign = _mm_set1_ps(-0.0f);
+  __m128 v0[3], e1[3], e2[3], Ds[3], s[3];
+  __m128 e1M[3], e2M[3], DM[3], sM[3];
+  for (int axis = 0; axis != 3; ++axis) {
+    v0[axis] = _mm_load_ps(lanes[V0_X + axis]);
+    e1[axis] = _mm_load_ps(lanes[E1_X + axis]);
+    e2[axis] = _mm_load_ps(lanes[E2_X + axis]);
+    Ds[axis] = _mm_set1_ps(D[axis]);
+    s[axis] = _mm_sub_ps(_mm_set1_ps(O[axis]), v0[axis]);
+    e1M[axis] = _mm_andnot_ps(sign, e1[axis]);
+    e2M[axis] = _mm_andnot_ps(sign, e2[axis]);
+    DM[axis] = _mm_set1_ps(abs(D[axis]));
+    sM[axis] = _mm_add_ps(_mm_set1_ps(abs(O[axis])),
+                          _mm_andnot_ps(sign, v0[axis]));
+  }
+
+  // Four triangles at once
+  __m128 h[3], q[3], hM[3], qM[3];
+  for (int axis = 0; axis != 3; ++axis) {
+    int next = (axis + 1) % 3;
+    int prev = (axis + 2) % 3;
+    h[axis] = _mm_sub_ps(_mm_mul_ps(Ds[next], e2[prev]),
+                         _mm_mul_ps(Ds[prev], e2[next]));
+    q[axis] = _mm_sub_ps(_mm_mul_ps(s[next], e1[prev]),
+                         _mm_mul_ps(s[prev], e1[next]));
+    hM[axis] = _mm_add_ps(_mm_mul_ps(DM[next], e2M[prev]),
+                          _mm_mul_ps(DM[prev], e2M[next]));
+    qM[axis] = _mm_add_ps(_mm_mul_ps(sM[next], e1M[prev]),
+                          _mm_mul_ps(sM[prev], e1M[next]));
+  }
+  __m128 a = _mm_setzero_ps(), aM = _mm_setzero_ps();
+  __m128 sh = _mm_setzero_ps(), shM = _mm_setzero_ps();
+  __m128 Dq = _mm_setzero_ps(), DqM = _mm_setzero_ps();
+  __m128 e2q = _mm_setzero_ps(), e2qM = _mm_setzero_ps();
+  for (int axis = 0; axis != 3; ++axis) {
+    a = _mm_add_ps(a, _mm_mul_ps(e1[axis], h[axis]));
+    sh = _mm_add_ps(sh, _mm_mul_ps(s[axis], h[axis]));
+    Dq = _mm_add_ps(Dq, _mm_mul_ps(Ds[axis], q[axis]));
+    e2q = _mm_add_ps(e2q, _mm_mul_ps(e2[axis], q[axis]));
+    aM = _mm_add_ps(aM, _mm_mul_ps(e1M[axis], hM[axis]));
+    shM = _mm_add_ps(shM, _mm_mul_ps(sM[axis], hM[axis]));
+    DqM = _mm_add_ps(DqM, _mm_mul_ps(DM[axis], qM[axis]));
+    e2qM = _mm_add_ps(e2qM, _mm_mul_ps(e2M[axis], qM[axis]));
+  }
+  __m128 error = _mm_set1_ps(ERROR);
+  __m128 aError = _mm_mul_ps(error, aM);
+  __m128 shError = _mm_mul_ps(error, shM);
+  __m128 DqError = _mm_mul_ps(error, DqM);
+  __m128 e2qError = _mm_mul_ps(error, e2qM);
+
+  // Flip the signs as if a was positive
+  __m128 aSign = _mm_and_ps(sign, a);
+  a = _mm_xor_ps(a, aSign);
+  sh = _mm_xor_ps(sh, aSign);
+  Dq = _mm_xor_ps(Dq, aSign);
+  e2q = _mm_xor_ps(e2q, aSign);
+
+  __m128 zero = _mm_setzero_ps();
+  __m128 aUpper = _mm_add_ps(a, aError);
+  __m128 hit = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(sh, shError), zero),
+                          _mm_cmpge_ps(_mm_add_ps(Dq, DqError), zero));
+  hit = _mm_and_ps(
+      hit, _mm_cmple_ps(_mm_add_ps(sh, Dq),
+                        _mm_add_ps(aUpper, _mm_add_ps(shError, DqError))));
+  hit = _mm_and_ps(
+      hit, _mm_cmple_ps(e2q, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(limit), aUpper),
+                                        e2qError)));
+  hit = _mm_or_ps(hit, _mm_cmple_ps(a, aError));
+  return _mm_movemask_ps(hit) & used;
+#else
+  unsigned mask = 0;
+  for (unsigned lane = 0; lane != 4; ++lane) {
+    float s[3], sM[3], h[3], hM[3], q[3], qM[3];
+    for (int axis = 0; axis != 3; ++axis) {
+      s[axis] = O[axis] - lanes[V0_X + axis][lane];
+      sM[axis] = abs(O[axis]) + abs(lanes[V0_X + axis][lane]);
+    }
+    for (int axis = 0; axis != 3; ++axis) {
+      int next = (axis + 1) % 3;
+      int prev = (axis + 2) % 3;
+      h[axis] = D[next] * lanes[E2_X + prev][lane] -
+                D[prev] * lanes[E2_X + next][lane];
+      q[axis] = s[next] * lanes[E1_X + prev][lane] -
+                s[prev] * lanes[E1_X + next][lane];
+      hM[axis] = abs(D[next]) * abs(lanes[E2_X + prev][lane]) +
+                 abs(D[prev]) * abs(lanes[E2_X + next][lane]);
+      qM[axis] = sM[next] * abs(lanes[E1_X + prev][lane]) +
+                 sM[prev] * abs(lanes[E1_X + next][lane]);
+    }
+    float a = 0.0f, sh = 0.0f, Dq = 0.0f, e2q = 0.0f;
+    float aM = 0.0f, shM = 0.0f, DqM = 0.0f, e2qM = 0.0f;
+    for (int axis = 0; axis != 3; ++axis) {
+      a += lanes[E1_X + axis][lane] * h[axis];
+      sh += s[axis] * h[axis];
+      Dq += D[axis] * q[axis];
+      e2q += lanes[E2_X + axis][lane] * q[axis];
+      aM += abs(lanes[E1_X + axis][lane]) * hM[axis];
+      shM += sM[axis] * hM[axis];
+      DqM += abs(D[axis]) * qM[axis];
+      e2qM += abs(lanes[E2_X + axis][lane]) * qM[axis];
+    }
+    if (a < 0.0f) { // flip the signs as if a was positive
+      a = -a;
+      sh = -sh;
+      Dq = -Dq;
+      e2q = -e2q;
+    }
+
+    float aError = ERROR * aM;
+    float shError = ERROR * shM;
+    float DqError = ERROR * DqM;
+    float e2qError = ERROR * e2qM;
+    if (a <= aError ||
+        (sh + shError >= 0.0f && Dq + DqError >= 0.0f &&
+         sh + Dq <= a + aError + shError + DqError &&
+         e2q <= limit * (a + aError) + e2qError))
+      mask |= 1u << lane;
+  }
+  return mask & used;
+#endif
+}
+
+double TriangleArray::intersect(Ray const &ray, size_t idx, double &u,
+                                double &v) const {
+  float p0[3], e1[3], e2[3];
+  corners(idx, p0, e1, e2);
+  Point v0(p0[0], p0[1], p0[2]);
+  Vector edge1(e1[0], e1[1], e1[2]);
+  Vector edge2(e2[0], e2[1], e2[2]);
+
+  // Möller-Trumbore
+  double const miss = numeric_limits<double>::quiet_NaN();
+  Vector h = ray.D.cross(edge2);
+  double a = edge1.dot(h);
+  if (a > -DBL_EPSILON && a < DBL_EPSILON)
+    return miss;
+
+  double f = 1 / a;
+  Vector s = ray.O - v0;
+  u = f * s.dot(h);
+  if (u < 0.0 || u > 1.0)
+    return miss;
+
+  Vector q = s.cross(edge1);
+  v = f * ray.D.dot(q);
+  if (v < 0.0 || u + v > 1.0)
+    return miss;
+
+  double t = f * edge2.dot(q);
+  if (t <= DBL_EPSILON) // line intersection (not ray)
+    return miss;
+  return t;
+}
@@ -0,0 +1,68 @@
+#ifndef TRIANGLEARRAY_H_
+#define TRIANGLEARRAY_H_
+
+#include "../aabb.h"
+#include "../ray.h"
+#include "../triple.h"
+
+#include <memory>
+#include <vector>
+
+// Triangles as indices into an array of vertices in single precision, so
+// vertices shared by triangles are stored once. A triangle is intersected
+// as its first vertex and the two edges leaving it, as used by
+// Möller-Trumbore. A ray is tested against four triangles at once in single
+// precision, which only selects the candidates; the hits are decided in
+// double precision.
+class TriangleArray {
+public:
+  // Triangles from three consecutive indices each into vertices, which
+  // holds x, y and z of every vertex
+  void build(std::vector<float> &&vertices, std::vector<unsigned> &&indices);
+
+  // Use vertices and indices stored elsewhere (e.g. a mapped file), which
+  // are kept alive by storage. indices holds 3 * count indices.
+  void assign(float const *vertices, size_t numVertices,
+              unsigned const *indices, size_t count,
+              std::shared_ptr<void const> const &storage);
+
+  size_t size() const { return d_count; }
+  size_t numVertices() const { return d_numVertices; }
+  float const *vertexData() const { return d_vertices; }
+  unsigned const *indexData() const { return d_indices; }
+  size_t memoryUsage() const; // bytes used by the vertices and indices
+
+  AABB boundingBox(size_t idx) const;
+  Vector normal(size_t idx) const; // unit normal, edge1 x edge2
+
+  // Closest hit with the triangles indices[0, count) in (ray.tmin, tmax).
+  // On a hit, tmax is lowered to it and the index of the triangle and the
+  // barycentric coordinates of the hit are set.
+  bool intersect(Ray const &ray, unsigned const *indices, unsigned count,
+                 double &tmax, unsigned &nearest, double &u,
+                 double &v) const;
+
+  // Whether any of the triangles is hit in (ray.tmin, tmax)
+  bool occluded(Ray const &ray, unsigned const *indices, unsigned count,
+                double tmax) const;
+
+private:
+  float const *d_vertices = nullptr;
+  size_t d_numVertices = 0;
+  unsigned const *d_indices = nullptr;
+  size_t d_count = 0;
+  std::shared_ptr<void const> d_storage; // owner of the data
+
+  // The first vertex of triangle idx and its edges to the other two
+  void corners(size_t idx, float v0[3], float edge1[3], float edge2[3]) const;
+
+  // Bitmask of the triangles indices[0, count) (at most four) which may be
+  // hit before tmax, erring on the side of a hit
+  unsigned candidates(Ray const &ray, unsigned const *indices, unsigned count,
+                      double tmax) const;
+
+  // Möller-Trumbore in double precision, NaN on a miss
+  double intersect(Ray const &ray, size_t idx, double &u, double &v) const;
+};
+
+#endif
@@ -0,0 +1,418 @@
+#include "texture.h"
+
+#include "lode/lodepng.h"
+#include "texturecache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+// IEEE 754 half precision, rounded to nearest even. Values out of range
+// become infinities; subnormals are kept.
+uint16_t toHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) // infinity or NaN
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if (exponent >= 0x1f)
+    return sign | 0x7c00;
+  if (exponent <= 0) {
+    if (exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    unsigned shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+      ++half;
+    return sign | half;
+  }
+  uint32_t half = uint32_t(exponent) << 10 | mantissa >> 13;
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    ++half; // may carry into the exponent, which rounds up correctly
+  return sign | half;
+}
+
+float fromHalf(uint16_t half) {
+  uint32_t sign = uint32_t(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | mantissa << 13;
+  } else if (exponent != 0) {
+    bits = sign | (exponent + 127 - 15) << 23 | mantissa << 13;
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else { // subnormal, normalized as a float
+    exponent = 127 - 15 + 1;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | exponent << 23 | (mantissa & 0x3ff) << 13;
+  }
+  float value;
+  memcpy(&value, &bits, sizeof value);
+  return value;
+}
+
+// Width and height in texels of the tiles of the TILED layout
+unsigned const TILE_SIZE = 4;
+
+// Width in texels of the pages (TileCache::PAGE_SIZE bytes) of the TILED
+// layout. Their height follows from the size of a texel.
+unsigned const PAGE_WIDTH = 32;
+
+// Most samples taken along the footprint by ANISOTROPIC filtering
+unsigned const MAX_PROBES = 8;
+
+// The color components of 8 bit channels, byte / 255.0 without dividing
+struct ByteValues {
+  double value[256];
+  ByteValues() {
+    for (unsigned byte = 0; byte != 256; ++byte)
+      value[byte] = byte / 255.0;
+  }
+};
+ByteValues const BYTE_VALUES;
+
+// Length of (x, y), without the care of hypot for overflow, which is slow
+double length(double x, double y) { return sqrt(x * x + y * y); }
+
+// Clamps u to [0, 1], NaN becomes 0
+double clamp01(double u) { return u > 0.0 ? (u < 1.0 ? u : 1.0) : 0.0; }
+} // namespace
+
+Texture::Texture(string const &filename, Layout layout) : d_layout(layout) {
+  vector<unsigned char> file;
+  lodepng::State state;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned error = lodepng::load_file(file, filename);
+  if (!error)
+    error = lodepng_inspect(&width, &height, &state, file.data(), file.size());
+  vector<unsigned char> image;
+  d_format = !error && state.info_png.color.bitdepth == 16 ? RGBA16F : RGBA8;
+  if (!error)
+    error = lodepng::decode(image, width, height, file, LCT_RGBA,
+                            d_format == RGBA16F ? 16 : 8);
+  if (error)
+    throw runtime_error("Could not read texture " + filename + ": " +
+                        lodepng_error_text(error));
+  d_pageShift = d_format == RGBA8 ? 5 : 4;
+  addLevels(width, height);
+  for (unsigned y = 0; y != height; ++y) {
+    for (unsigned x = 0; x != width; ++x) {
+      size_t idx = index(d_levels[0], x, y);
+      size_t pixel = 4 * (size_t(y) * width + x);
+      for (unsigned comp = 0; comp != 4; ++comp) {
+        if (d_format == RGBA8) {
+          d_bytes[idx + comp] = image[pixel + comp];
+          continue;
+        }
+        // 16 bit channels are stored big endian
+        unsigned char const *value = &image[2 * (pixel + comp)];
+        d_halfs[idx + comp] = toHalf((value[0] << 8 | value[1]) / 65535.0f);
+      }
+    }
+  }
+  buildLevels();
+}
+
+Texture::Texture(Format format, unsigned width, unsigned height,
+                 shared_ptr<TileCache::Source> const &source)
+    : d_format(format), d_layout(TILED), d_pageShift(format == RGBA8 ? 5 : 4),
+      d_source(source) {
+  addLevels(width, height);
+  if (memoryUsage() != source->numPages() * TileCache::PAGE_SIZE)
+    throw runtime_error("The pages of a texture have the wrong size.");
+}
+
+size_t Texture::memoryUsage() const {
+  return d_size * (d_format == RGBA8 ? sizeof(uint8_t) : sizeof(uint16_t));
+}
+
+char const *Texture::data() const {
+  return d_format == RGBA8 ? reinterpret_cast<char const *>(d_bytes.data())
+                           : reinterpret_cast<char const *>(d_halfs.data());
+}
+
+// Index of the first channel of texel (x, y) of a level. In the TILED
+// layout pages are stored row by row, as are the tiles of a page and the
+// texels of a tile.
+size_t Texture::index(Level const &level, unsigned x, unsigned y) const {
+  if (d_layout == ROW_MAJOR)
+    return level.offset + 4 * (size_t(y) * level.width + x);
+
+  unsigned px = x % PAGE_WIDTH;
+  unsigned py = y & ((1u << d_pageShift) - 1);
+  size_t page = size_t(y >> d_pageShift) * level.pagesX + x / PAGE_WIDTH;
+  unsigned tile = py / TILE_SIZE * (PAGE_WIDTH / TILE_SIZE) + px / TILE_SIZE;
+  unsigned texel = py % TILE_SIZE * TILE_SIZE + px % TILE_SIZE;
+  return level.offset +
+         4 * ((page << d_pageShift) * PAGE_WIDTH +
+              tile * TILE_SIZE * TILE_SIZE + texel);
+}
+
+// The four channels of the texel at idx: in the storage, or copied from the
+// tile cache into buffer
+void const *Texture::channels(size_t idx, uint16_t buffer[4]) const {
+  if (!d_source)
+    return d_format == RGBA8 ? static_cast<void const *>(&d_bytes[idx])
+                             : static_cast<void const *>(&d_halfs[idx]);
+
+  size_t size = d_format == RGBA8 ? sizeof(uint8_t) : sizeof(uint16_t);
+  size_t byte = idx * size;
+  d_source->read(byte / TileCache::PAGE_SIZE, byte % TileCache::PAGE_SIZE,
+                 buffer, 4 * size);
+  return buffer;
+}
+
+// The color components of the texel at idx
+void Texture::fetch(size_t idx, double rgb[3]) const {
+  uint16_t buffer[4];
+  void const *texel = channels(idx, buffer);
+  for (unsigned comp = 0; comp != 3; ++comp)
+    rgb[comp] =
+        d_format == RGBA8
+            ? BYTE_VALUES.value[static_cast<uint8_t const *>(texel)[comp]]
+            : double(fromHalf(static_cast<uint16_t const *>(texel)[comp]));
+}
+
+float Texture::channel(size_t idx) const {
+  return d_format == RGBA8 ? d_bytes[idx] / 255.0f : fromHalf(d_halfs[idx]);
+}
+
+void Texture::setChannel(size_t idx, float value) {
+  if (d_format == RGBA8)
+    d_bytes[idx] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+  else
+    d_halfs[idx] = toHalf(value);
+}
+
+// Adds the levels of the mip pyramid of an image of width x height texels
+void Texture::addLevels(unsigned width, unsigned height) {
+  addLevel(width, height);
+  while (d_levels.back().width > 1 || d_levels.back().height > 1)
+    addLevel(max(1u, d_levels.back().width / 2),
+             max(1u, d_levels.back().height / 2));
+}
+
+// Appends a level of width x height texels to the storage (unless cached),
+// partially filled pages are padded
+void Texture::addLevel(unsigned width, unsigned height) {
+  unsigned pagesX = (width + PAGE_WIDTH - 1) / PAGE_WIDTH;
+  unsigned pagesY = (height + (1u << d_pageShift) - 1) >> d_pageShift;
+  size_t texels = d_layout == TILED
+                      ? (size_t(pagesX) * pagesY << d_pageShift) * PAGE_WIDTH
+                      : size_t(width) * height;
+
+  d_levels.push_back(Level{width, height, pagesX, d_size});
+  d_size += 4 * texels;
+  if (d_source)
+    return;
+  if (d_format == RGBA8)
+    d_bytes.resize(d_size);
+  else
+    d_halfs.resize(d_size);
+}
+
+// Every texel of the next level averages a block of 2x2 texels of the
+// previous one. Of an odd size, the last row or column is repeated.
+void Texture::buildLevels() {
+  for (unsigned level = 1; level != numLevels(); ++level) {
+    Level const &prev = d_levels[level - 1];
+    Level const &next = d_levels[level];
+
+    for (unsigned y = 0; y != next.height; ++y) {
+      unsigned y0 = min(2 * y, prev.height - 1);
+      unsigned y1 = min(2 * y + 1, prev.height - 1);
+      for (unsigned x = 0; x != next.width; ++x) {
+        unsigned x0 = min(2 * x, prev.width - 1);
+        unsigned x1 = min(2 * x + 1, prev.width - 1);
+        for (unsigned comp = 0; comp != 4; ++comp) {
+          auto at = [&](unsigned px, unsigned py) {
+            return channel(index(prev, px, py) + comp);
+          };
+          float sum = at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1);
+          setChannel(index(next, x, y) + comp, sum / 4);
+        }
+      }
+    }
+  }
+}
+
+Color Texture::texel(unsigned level, unsigned x, unsigned y) const {
+  size_t idx = index(d_levels.at(level), x, y);
+  if (idx >= d_size)
+    throw out_of_range("Texel outside of the texture.");
+  double rgb[3];
+  fetch(idx, rgb);
+  return Color(rgb[0], rgb[1], rgb[2]);
+}
+
+Color Texture::colorAt(float x, float y) const {
+  return texel(0, static_cast<unsigned>(x * (width() - 1)),
+               static_cast<unsigned>(y * (height() - 1)));
+}
+
+Color Texture::sample(TextureCoordinates const &uv,
+                      TextureCoordinates const &dx,
+                      TextureCoordinates const &dy, Filter filter) const {
+  if (filter == NEAREST)
+    return colorAt(uv.u, uv.v);
+
+  // The sides of the footprint in texels of the full resolution image
+  double lengthX = length(dx.u * width(), dx.v * height());
+  double lengthY = length(dy.u * width(), dy.v * height());
+  double major = max(lengthX, lengthY);
+  double minor = min(lengthX, lengthY);
+
+  if (filter != ANISOTROPIC || !(major > minor))
+    return filter == BILINEAR ? bilinear(level(log2(major)), uv.u, uv.v)
+                              : trilinear(log2(major), uv.u, uv.v);
+
+  // Samples spread evenly over the longer side, at most MAX_PROBES
+  unsigned probes = static_cast<unsigned>(
+      min(double(MAX_PROBES), ceil(major / max(minor, 1e-12))));
+  TextureCoordinates const &axis = lengthX > lengthY ? dx : dy;
+  double lod = log2(major / probes);
+  Color color(0.0, 0.0, 0.0);
+  for (unsigned probe = 0; probe != probes; ++probe) {
+    double offset = (probe + 0.5) / probes - 0.5;
+    color += trilinear(lod, uv.u + offset * axis.u, uv.v + offset * axis.v);
+  }
+  return color / probes;
+}
+
+// The level nearest to the level of detail lod
+unsigned Texture::level(double lod) const {
+  return lod > 0.0 ? min(numLevels() - 1, unsigned(lod + 0.5)) : 0;
+}
+
+// Blends the two levels around the level of detail lod, the log2 of the
+// size of the footprint in texels of the full resolution image
+Color Texture::trilinear(double lod, double u, double v) const {
+  double maxLod = numLevels() - 1;
+  lod = lod > 0.0 ? (lod < maxLod ? lod : maxLod) : 0.0; // NaN becomes 0
+  unsigned level = static_cast<unsigned>(lod);
+  double weight = lod - level;
+  Color color = bilinear(level, u, v);
+  if (weight > 0.0)
+    color = (1.0 - weight) * color + weight * bilinear(level + 1, u, v);
+  return color;
+}
+
+// Texels are placed as colorAt does, texel x covering [x, x + 1) / (width -
+// 1), so filtering does not shift the texture. Border texels are repeated.
+Color Texture::bilinear(unsigned level, double u, double v) const {
+  Level const &lvl = d_levels[level];
+  double x = clamp01(u) * max(1u, lvl.width - 1) - 0.5;
+  double y = clamp01(v) * max(1u, lvl.height - 1) - 0.5;
+  double fx = floor(x);
+  double fy = floor(y);
+  double wx = x - fx;
+  double wy = y - fy;
+
+  int maxX = lvl.width - 1;
+  int maxY = lvl.height - 1;
+  unsigned x0 = max(0, min(maxX, int(fx)));
+  unsigned x1 = max(0, min(maxX, int(fx) + 1));
+  unsigned y0 = max(0, min(maxY, int(fy)));
+  unsigned y1 = max(0, min(maxY, int(fy) + 1));
+
+  // The four texels are read directly, mostly from the same tile
+  double c00[3], c10[3], c01[3], c11[3];
+  fetch(index(lvl, x0, y0), c00);
+  fetch(index(lvl, x1, y0), c10);
+  fetch(index(lvl, x0, y1), c01);
+  fetch(index(lvl, x1, y1), c11);
+  Color color;
+  for (unsigned comp = 0; comp != 3; ++comp) {
+    double top = (1.0 - wx) * c00[comp] + wx * c10[comp];
+    double bottom = (1.0 - wx) * c01[comp] + wx * c11[comp];
+    color.data[comp] = (1.0 - wy) * top + wy * bottom;
+  }
+  return color;
+}
+
+TextureStore &TextureStore::instance() {
+  static TextureStore store;
+  return store;
+}
+
+void TextureStore::setCache(string const &directory, size_t budget) {
+  lock_guard<mutex> lock(d_mutex);
+  d_cacheDirectory = directory;
+  d_tiles = TileCache::create(budget);
+}
+
+shared_ptr<TileCache const> TextureStore::tileCache() {
+  lock_guard<mutex> lock(d_mutex);
+  return d_tiles;
+}
+
+TexturePtr TextureStore::load(string const &filename) {
+  unique_lock<mutex> lock(d_mutex);
+  d_loaded.wait(lock, [&]() { return d_loading.count(filename) == 0; });
+  auto loaded = d_textures.find(filename);
+  if (loaded != d_textures.end())
+    return loaded->second;
+
+  // Decode without holding the lock, so other files load meanwhile
+  d_loading.insert(filename);
+  shared_ptr<TileCache> tiles = d_tiles;
+  string cacheDirectory = d_cacheDirectory;
+  lock.unlock();
+
+  TexturePtr texture;
+  try {
+    texture = tiles ? TextureCache(cacheDirectory, tiles).load(filename)
+                    : TexturePtr(new Texture(filename));
+  } catch (...) {
+    lock.lock();
+    d_loading.erase(filename);
+    d_loaded.notify_all();
+    throw;
+  }
+
+  char const *format =
+      texture->format() == Texture::RGBA8 ? "RGBA8" : "RGBA16F";
+#pragma omp critical(output)
+  cout << "Loaded texture " << filename << " (" << texture->width() << "x"
+       << texture->height() << " " << format << ", "
+       << texture->memoryUsage() / 1024
+       << (texture->cached() ? " KiB on disk).\n" : " KiB).\n");
+
+  lock.lock();
+  d_textures[filename] = texture;
+  d_loading.erase(filename);
+  d_loaded.notify_all();
+  return texture;
+}
+
+size_t TextureStore::size() {
+  lock_guard<mutex> lock(d_mutex);
+  return d_textures.size();
+}
+
+size_t TextureStore::memoryUsage() {
+  lock_guard<mutex> lock(d_mutex);
+  size_t bytes = 0;
+  for (auto const &texture : d_textures)
+    if (!texture.second->cached())
+      bytes += texture.second->memoryUsage();
+  return bytes;
+}
@@ -1,11 +1,134 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#include "image.h"
+#include "tilecache.h"
+#include "triple.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
-typedef Image Texture;
 struct TextureCoordinates {
   double u, v;
 };
 
+// An image sampled by materials, kept in a compact format: 8 bits per
+// channel (RGBA8), or half floats (RGBA16F) when the file has 16 bits per
+// channel. Texels are converted to colors when they are sampled. Besides the
+// image itself a mip pyramid is stored: every level halves the size of the
+// previous one, down to a single texel, and is used for filtered sampling.
+// The texels of a level are stored row by row (by default) or in tiles of
+// 4x4 texels so the texels around a sample share a cache line whichever
+// way the texture coordinates move over the image. The tiles are grouped in
+// pages of 4 KiB covering a block of the level, the unit in which the
+// texels of textures kept on disk (see texturecache.h) are read into memory.
+class Texture {
+public:
+  enum Format { RGBA8, RGBA16F };
+  enum Layout { ROW_MAJOR, TILED };
+  enum Filter { NEAREST, BILINEAR, TRILINEAR, ANISOTROPIC };
+
+  explicit Texture(std::string const &filename, Layout layout = ROW_MAJOR);
+
+  // A TILED texture whose texels (as data() stores them) are the pages of
+  // source, read through its tile cache. Throws if their size differs.
+  Texture(Format format, unsigned width, unsigned height,
+          std::shared_ptr<TileCache::Source> const &source);
+
+  unsigned width() const { return d_levels[0].width; }
+  unsigned height() const { return d_levels[0].height; }
+  unsigned numLevels() const { return d_levels.size(); }
+  Format format() const { return d_format; }
+  Layout layout() const { return d_layout; }
+  size_t memoryUsage() const; // bytes used by the texels of all levels
+  bool cached() const { return d_source != nullptr; } // kept on disk
+
+  // The texels of all levels, memoryUsage() bytes, of a texture which is
+  // not cached
+  char const *data() const;
+
+  Color texel(unsigned level, unsigned x, unsigned y) const;
+
+  // Normalized accessor, interval is (0...1, 0...1), the nearest texel of
+  // the full resolution image
+  Color colorAt(float x, float y) const;
+
+  // The color at uv, filtered over the footprint of a pixel: dx and dy are
+  // the changes of uv to the neighbouring pixels. NEAREST is colorAt,
+  // BILINEAR filters the level closest to the footprint, TRILINEAR blends
+  // the two levels around it. ANISOTROPIC averages trilinear samples along
+  // the longer side of the footprint, each covering about its shorter side,
+  // which keeps surfaces seen at grazing angles sharp.
+  Color sample(TextureCoordinates const &uv, TextureCoordinates const &dx,
+               TextureCoordinates const &dy, Filter filter) const;
+
+private:
+  struct Level {
+    unsigned width;
+    unsigned height;
+    unsigned pagesX; // pages in a row of pages
+    size_t offset;   // of its first channel
+  };
+
+  std::vector<Level> d_levels;
+  Format d_format = RGBA8;
+  Layout d_layout = ROW_MAJOR;
+  unsigned d_pageShift = 5;      // log2 of the height of a page in texels
+  size_t d_size = 0;             // channels of all levels
+  std::vector<uint8_t> d_bytes;  // RGBA8 texels of all levels
+  std::vector<uint16_t> d_halfs; // RGBA16F texels of all levels
+  std::shared_ptr<TileCache::Source> d_source; // the texels, if cached
+
+  size_t index(Level const &level, unsigned x, unsigned y) const;
+  void const *channels(size_t idx, uint16_t buffer[4]) const;
+  void fetch(size_t idx, double rgb[3]) const;
+  float channel(size_t idx) const;
+  void setChannel(size_t idx, float value);
+  void addLevels(unsigned width, unsigned height);
+  void addLevel(unsigned width, unsigned height);
+  void buildLevels();
+  Color bilinear(unsigned level, double u, double v) const;
+  Color trilinear(double lod, double u, double v) const;
+  unsigned level(double lod) const;
+};
+
+typedef std::shared_ptr<Texture const> TexturePtr;
+
+// The textures of the process. Every file is decoded once, however many
+// materials use it; the materials share the texture through a TexturePtr,
+// which is never modified after loading. Different files are decoded
+// concurrently when loaded from several threads.
+class TextureStore {
+  std::mutex d_mutex;
+  std::condition_variable d_loaded; // signalled when a load finishes
+  std::map<std::string, TexturePtr> d_textures;
+  std::set<std::string> d_loading; // being decoded by some thread
+  std::string d_cacheDirectory;
+  std::shared_ptr<TileCache> d_tiles; // of the cached textures, if any
+
+public:
+  static TextureStore &instance();
+
+  // Textures loaded from now on are kept in the on-disk cache in directory
+  // (see texturecache.h), with at most budget bytes of their texels in
+  // memory at any time
+  void setCache(std::string const &directory, size_t budget);
+  std::shared_ptr<TileCache const> tileCache(); // nullptr without a cache
+
+  // The texture in filename, decoding it if it was not loaded before. Waits
+  // if another thread is decoding the same file.
+  TexturePtr load(std::string const &filename);
+
+  size_t size();        // number of textures loaded
+  size_t memoryUsage(); // bytes of the texels of the textures not cached
+
+private:
+  TextureStore() = default;
+};
+
 #endif /* TEXTURE_H */
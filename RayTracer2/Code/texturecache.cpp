@@ -0,0 +1,108 @@
+#include "texturecache.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+char const MAGIC[8] = {'R', 'T', 'T', 'E', 'X', 'T', 0, 0};
+// Increase when the layout of the file, Texture::index or the filtering of
+// the mip pyramid changes
+uint32_t const VERSION = 1;
+
+// Layout of a cache file: this header, padded to a page, followed by the
+// pages of the texels of all levels
+struct Header {
+  CacheHeader cache;
+  uint32_t format; // Texture::Format
+  uint32_t width;
+  uint32_t height;
+  uint32_t padding;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+} // namespace
+
+TextureCache::TextureCache(string const &directory,
+                           shared_ptr<TileCache> const &tiles)
+    : d_directory(directory), d_tiles(tiles) {}
+
+TexturePtr TextureCache::load(string const &filename) const {
+  unique_ptr<CacheFile> cache;
+  try {
+    cache.reset(new CacheFile(d_directory, filename, ".texture", MAGIC,
+                              VERSION, sizeof(Header)));
+  } catch (exception const &) {
+    // Let the decoder report the problem
+    return TexturePtr(new Texture(filename));
+  }
+
+  TexturePtr texture = read(*cache);
+  if (texture) {
+#pragma omp critical(output)
+    cout << "Mapped " << filename << " from " << cache->name() << ".\n";
+    return texture;
+  }
+
+  // Convert the file once, then read it from the cache like later renders.
+  // The cache file holds the pages of the tiled layout.
+  TexturePtr decoded(new Texture(filename, Texture::TILED));
+  if (write(*cache, *decoded))
+    texture = read(*cache);
+  return texture ? texture : decoded;
+}
+
+TexturePtr TextureCache::read(CacheFile const &cache) const {
+  shared_ptr<MappedFile> file = cache.map();
+  if (!file)
+    return nullptr; // not cached yet
+
+  // Reject anything that is not exactly what write() would produce now
+  Header header;
+  bool valid = cache.matches(*file);
+  if (valid) {
+    memcpy(&header, file->data(), sizeof(Header));
+    valid = header.format <= Texture::RGBA16F &&
+            header.dataOffset % TileCache::PAGE_SIZE == 0 &&
+            header.dataSize % TileCache::PAGE_SIZE == 0 &&
+            header.dataOffset + header.dataSize == file->size();
+  }
+
+  // The texels are read from the mapping, a page at a time
+  TexturePtr texture;
+  try {
+    if (valid)
+      texture = TexturePtr(new Texture(
+          static_cast<Texture::Format>(header.format), header.width,
+          header.height,
+          d_tiles->source(file, header.dataOffset,
+                          header.dataSize / TileCache::PAGE_SIZE)));
+  } catch (exception const &) {
+  }
+  if (!texture) {
+#pragma omp critical(output)
+    cerr << "Ignoring stale texture cache " << cache.name() << ".\n";
+  }
+  return texture;
+}
+
+bool TextureCache::write(CacheFile const &cache,
+                         Texture const &texture) const {
+  Header header;
+  memset(&header, 0, sizeof(Header));
+  header.format = texture.format();
+  header.width = texture.width();
+  header.height = texture.height();
+  header.dataOffset = TileCache::PAGE_SIZE;
+  header.dataSize = texture.memoryUsage();
+  header.cache = cache.header(header.dataOffset + header.dataSize);
+
+  return cache.write([&](ostream &out) {
+    out.write(reinterpret_cast<char const *>(&header), sizeof(Header));
+    vector<char> padding(header.dataOffset - sizeof(Header), 0);
+    out.write(padding.data(), padding.size());
+    out.write(texture.data(), header.dataSize);
+  });
+}
@@ -0,0 +1,33 @@
+#ifndef TEXTURECACHE_H_
+#define TEXTURECACHE_H_
+
+#include "mappedfile.h"
+#include "texture.h"
+#include "tilecache.h"
+
+#include <memory>
+#include <string>
+
+// On-disk cache of textures. The first time a texture file is loaded it is
+// decoded, its mip pyramid is built and the texels are written, in pages of
+// tiles (see Texture), to <directory>/<hash>.texture, where hash is computed
+// from the contents of the image file. Renders map that file and read the
+// pages they sample through a tile cache, so only the parts of a texture in
+// use are kept in memory. Entries written by another version of the format,
+// or for other contents, are rebuilt.
+class TextureCache {
+  std::string d_directory;
+  std::shared_ptr<TileCache> d_tiles;
+
+public:
+  TextureCache(std::string const &directory,
+               std::shared_ptr<TileCache> const &tiles);
+
+  TexturePtr load(std::string const &filename) const;
+
+private:
+  TexturePtr read(CacheFile const &cache) const;
+  bool write(CacheFile const &cache, Texture const &texture) const;
+};
+
+#endif
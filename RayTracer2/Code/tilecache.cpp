@@ -0,0 +1,120 @@
+#include "tilecache.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+// Fewest slots of a cache, such that concurrent readers rarely evict the
+// pages of each other before copying from them
+size_t const MIN_SLOTS = 256;
+} // namespace
+
+TileCache::Source::Source(shared_ptr<TileCache> const &cache,
+                          shared_ptr<MappedFile const> const &file,
+                          size_t offset, size_t numPages)
+    : d_cache(cache), d_file(file), d_data(file->data() + offset),
+      d_numPages(numPages), d_table(new atomic<uint32_t>[numPages]) {
+  for (size_t page = 0; page != numPages; ++page)
+    d_table[page].store(EMPTY, memory_order_relaxed);
+}
+
+TileCache::Source::~Source() { d_cache->release(*this); }
+
+void TileCache::Source::read(size_t page, size_t offset, void *out,
+                             size_t size) const {
+  while (true) {
+    uint32_t slotIdx = d_table[page].load(memory_order_acquire);
+    if (slotIdx != EMPTY) {
+      Slot &slot = d_cache->d_slots[slotIdx];
+      uint32_t sequence = slot.sequence.load(memory_order_acquire);
+      if (!(sequence & 1)) {
+        memcpy(out, slot.data.get() + offset, size);
+        atomic_thread_fence(memory_order_acquire);
+        // The copy is valid if the slot still held this page throughout
+        if (slot.sequence.load(memory_order_relaxed) == sequence &&
+            d_table[page].load(memory_order_relaxed) == slotIdx) {
+          if (!slot.referenced.load(memory_order_relaxed))
+            slot.referenced.store(1, memory_order_relaxed);
+          return;
+        }
+      }
+    }
+    d_cache->load(*this, page);
+  }
+}
+
+shared_ptr<TileCache> TileCache::create(size_t budget) {
+  shared_ptr<TileCache> cache(
+      new TileCache(max(MIN_SLOTS, budget / PAGE_SIZE)));
+  cache->d_self = cache;
+  return cache;
+}
+
+TileCache::TileCache(size_t numSlots)
+    : d_numSlots(numSlots), d_slots(new Slot[numSlots]) {}
+
+shared_ptr<TileCache::Source>
+TileCache::source(shared_ptr<MappedFile const> const &file, size_t offset,
+                  size_t numPages) {
+  return shared_ptr<Source>(
+      new Source(d_self.lock(), file, offset, numPages));
+}
+
+uint64_t TileCache::pagesRead() const {
+  return d_pagesRead.load(memory_order_relaxed);
+}
+
+// Reads page of source into a slot, unless another thread did already
+uint32_t TileCache::load(Source const &source, size_t page) {
+  lock_guard<mutex> lock(d_mutex);
+  uint32_t present = source.d_table[page].load(memory_order_relaxed);
+  if (present != EMPTY)
+    return present;
+
+  // A new slot while the budget allows, else the clock: pass over recently
+  // used slots, clearing their mark
+  size_t slotIdx;
+  if (d_numUsed != d_numSlots) {
+    slotIdx = d_numUsed++;
+    d_slots[slotIdx].data.reset(new char[PAGE_SIZE]);
+  } else {
+    while (true) {
+      slotIdx = d_hand;
+      d_hand = (d_hand + 1) % d_numSlots;
+      Slot &slot = d_slots[slotIdx];
+      if (!slot.source || !slot.referenced.load(memory_order_relaxed))
+        break;
+      slot.referenced.store(0, memory_order_relaxed);
+    }
+  }
+
+  Slot &slot = d_slots[slotIdx];
+  if (slot.source)
+    slot.source->d_table[slot.page].store(EMPTY, memory_order_relaxed);
+
+  uint32_t sequence = slot.sequence.load(memory_order_relaxed);
+  slot.sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(slot.data.get(), source.d_data + page * PAGE_SIZE, PAGE_SIZE);
+  slot.sequence.store(sequence + 2, memory_order_release);
+
+  slot.source = &source;
+  slot.page = page;
+  slot.referenced.store(1, memory_order_relaxed);
+  source.d_table[page].store(slotIdx, memory_order_release);
+  d_pagesRead.fetch_add(1, memory_order_relaxed);
+  return slotIdx;
+}
+
+// Forgets the pages of a source that is destroyed
+void TileCache::release(Source const &source) {
+  lock_guard<mutex> lock(d_mutex);
+  for (size_t slotIdx = 0; slotIdx != d_numUsed; ++slotIdx) {
+    if (d_slots[slotIdx].source == &source) {
+      d_slots[slotIdx].source = nullptr;
+      d_slots[slotIdx].referenced.store(0, memory_order_relaxed);
+    }
+  }
+}
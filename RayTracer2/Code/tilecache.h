@@ -0,0 +1,84 @@
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include "mappedfile.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A bounded set of pages (4 KiB) of memory mapped files, kept in memory
+// while they are used. Reading a page that is in memory takes no lock: a
+// slot is only rewritten under its sequence number, so readers copy the
+// bytes they need and retry when the slot changed meanwhile. Missing pages
+// are copied from the mapping under a lock, into a new slot while the
+// budget allows, otherwise replacing the page that was least recently used
+// as judged by the clock algorithm. The memory of a slot is allocated when
+// it is first used, so a cache holds no more pages than were read.
+class TileCache {
+public:
+  static size_t const PAGE_SIZE = 4096;
+
+  // The pages of (part of) a mapped file, read through a cache
+  class Source {
+  public:
+    ~Source();
+
+    size_t numPages() const { return d_numPages; }
+
+    // Copies size bytes at offset in page to out, reading the page into the
+    // cache if it is not there. The bytes may not cross the end of a page.
+    void read(size_t page, size_t offset, void *out, size_t size) const;
+
+  private:
+    friend class TileCache;
+
+    Source(std::shared_ptr<TileCache> const &cache,
+           std::shared_ptr<MappedFile const> const &file, size_t offset,
+           size_t numPages);
+
+    std::shared_ptr<TileCache> d_cache;
+    std::shared_ptr<MappedFile const> d_file;
+    char const *d_data; // first page in the mapping
+    size_t d_numPages;
+    std::unique_ptr<std::atomic<uint32_t>[]> d_table; // slot of every page
+  };
+
+  // Keeps at most budget bytes of pages in memory
+  static std::shared_ptr<TileCache> create(size_t budget);
+
+  // Pages [0, numPages) start at offset (a multiple of PAGE_SIZE) in file
+  std::shared_ptr<Source> source(std::shared_ptr<MappedFile const> const &file,
+                                 size_t offset, size_t numPages);
+
+  size_t budget() const { return d_numSlots * PAGE_SIZE; }
+  uint64_t pagesRead() const; // pages copied from files so far
+
+private:
+  static uint32_t const EMPTY = 0xffffffffu;
+
+  struct Slot {
+    std::atomic<uint32_t> sequence{0}; // odd while the page is replaced
+    std::atomic<uint8_t> referenced{0};
+    Source const *source = nullptr;    // owner, guarded by d_mutex
+    size_t page = 0;
+    std::unique_ptr<char[]> data;      // PAGE_SIZE bytes, once the slot is used
+  };
+
+  size_t d_numSlots;
+  std::unique_ptr<Slot[]> d_slots;
+  std::mutex d_mutex;   // guards replacing pages
+  size_t d_numUsed = 0; // slots [0, d_numUsed) have their memory
+  size_t d_hand = 0;    // next slot the clock considers
+  std::atomic<uint64_t> d_pagesRead{0};
+  std::weak_ptr<TileCache> d_self;
+
+  explicit TileCache(size_t numSlots);
+
+  uint32_t load(Source const &source, size_t page);
+  void release(Source const &source);
+};
+
+#endif
@@ -122,6 +122,12 @@ void Triple::normalize() {
   z *= invlen;
 }
 
+// Rodrigues' rotation formula
+Triple Triple::rotated(double angle, Triple const &axis) const {
+  return (*this) * cos(angle) + (axis.cross(*this) * sin(angle)) +
+         axis * (axis.dot(*this)) * (1 - cos(angle));
+}
+
 // --- Color functions ---------------------------------------------------------
 
 void Triple::set(double f) {
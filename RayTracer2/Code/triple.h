@@ -79,6 +79,9 @@ public:
   Triple normalized() const; // normalized COPY
   void normalize();          // normalize THIS
 
+  // rotated COPY, angle (radians) around the normalized axis
+  Triple rotated(double angle, Triple const &axis) const;
+
   // --- Color functions
   // ---------------------------------------------------------
 
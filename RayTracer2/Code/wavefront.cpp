@@ -0,0 +1,307 @@
+#include "wavefront.h"
+
+#include "hit.h"
+#include "image.h"
+#include "light.h"
+#include "material.h"
+#include "object.h"
+#include "scene.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Number of samples traced together, bounds the memory used by the queues
+unsigned const WAVE_SIZE = 1 << 16;
+} // namespace
+
+void Wavefront::RayQueue::resize(size_t size) {
+  for (int axis = 0; axis != 3; ++axis) {
+    O[axis].resize(size);
+    D[axis].resize(size);
+  }
+  path.resize(size);
+  differentials.resize(size);
+}
+
+void Wavefront::RayQueue::set(size_t idx, Ray const &ray,
+                              RayDifferentials const &differentials,
+                              unsigned path) {
+  for (int axis = 0; axis != 3; ++axis) {
+    O[axis][idx] = ray.O.data[axis];
+    D[axis][idx] = ray.D.data[axis];
+  }
+  this->path[idx] = path;
+  this->differentials[idx] = differentials;
+}
+
+Ray Wavefront::RayQueue::ray(size_t idx) const {
+  return Ray(Point(O[0][idx], O[1][idx], O[2][idx]),
+             Vector(D[0][idx], D[1][idx], D[2][idx]));
+}
+
+void Wavefront::HitQueue::resize(size_t size) {
+  object.resize(size);
+  t.resize(size);
+  for (int axis = 0; axis != 3; ++axis) {
+    N[axis].resize(size);
+    P[axis].resize(size);
+  }
+}
+
+void Wavefront::LightQueue::resize(size_t size) {
+  for (int axis = 0; axis != 3; ++axis)
+    L[axis].resize(size);
+  distance.resize(size);
+  diffuse.resize(size);
+  specular.resize(size);
+  blocked.resize(size);
+}
+
+Wavefront::Wavefront(Scene &scene) : scene(scene) {}
+
+void Wavefront::render(Image &img) {
+  unsigned samples = scene.samplesPerPixel();
+  unsigned numPixels = img.width() * img.height();
+  unsigned pixelsPerWave = max(1U, WAVE_SIZE / max(1U, samples));
+  numBounces = scene.recursionDepth;
+
+  for (unsigned first = 0; first < numPixels; first += pixelsPerWave) {
+    unsigned count = min(pixelsPerWave, numPixels - first);
+    generate(img, first, count, samples);
+    local.assign(size_t(numBounces) * numPaths, Color(0.0, 0.0, 0.0));
+    ks.assign(size_t(numBounces) * numPaths, 0.0);
+
+    for (unsigned bounce = 0; bounce != numBounces && rays.size() != 0;
+         ++bounce) {
+      intersect();
+      shade(bounce);
+      if (scene.renderShadows) {
+        resolveShadows();
+        accumulate(bounce);
+      }
+
+      // The last bounce is not reflected, trace would return black
+      if (bounce + 1 != numBounces)
+        emitReflections();
+    }
+
+    resolve(img, first, count, samples);
+  }
+}
+
+// Primary rays of the pixels [firstPixel, firstPixel + numPixels) in row
+// major order, the samples of a pixel are consecutive paths
+void Wavefront::generate(Image const &img, unsigned firstPixel,
+                         unsigned numPixels, unsigned samples) {
+  unsigned w = img.width();
+  unsigned h = img.height();
+  numPaths = numPixels * samples;
+  rays.resize(numPaths);
+
+#pragma omp parallel
+  {
+    vector<Ray> primary;
+
+#pragma omp for
+    for (unsigned pixel = 0; pixel < numPixels; ++pixel) {
+      primary.clear();
+      scene.primaryRays((firstPixel + pixel) % w, (firstPixel + pixel) / w, h,
+                        primary);
+      for (unsigned sample = 0; sample != samples; ++sample) {
+        unsigned path = pixel * samples + sample;
+        rays.set(path, primary[sample],
+                 scene.primaryDifferentials(primary[sample]), path);
+      }
+    }
+  }
+}
+
+// Neighbouring rays in the queue are traced together in packets of the
+// scene's packet size, as rendering depth first does for primary rays
+void Wavefront::intersect() {
+  hits.resize(rays.size());
+  size_t const packetSize = scene.packetSize;
+  size_t numPackets = (rays.size() + packetSize - 1) / packetSize;
+
+#pragma omp parallel
+  {
+    vector<Ray> packet;
+    vector<Hit> packetHits;
+    vector<ObjectPtr> objs;
+
+#pragma omp for schedule(dynamic, 4)
+    for (size_t packetIdx = 0; packetIdx < numPackets; ++packetIdx) {
+      size_t first = packetIdx * packetSize;
+      size_t count = min(packetSize, rays.size() - first);
+      packet.clear();
+      for (size_t lane = 0; lane != count; ++lane)
+        packet.push_back(rays.ray(first + lane));
+      packetHits.assign(count, Hit::NO_HIT());
+      objs.assign(count, nullptr);
+      scene.closestHits(packet.data(), packetHits.data(), objs.data(), count);
+
+      for (size_t lane = 0; lane != count; ++lane) {
+        size_t idx = first + lane;
+        hits.object[idx] = objs[lane].get();
+        hits.t[idx] = packetHits[lane].t;
+        for (int axis = 0; axis != 3; ++axis)
+          hits.N[axis][idx] = packetHits[lane].N.data[axis];
+      }
+    }
+  }
+}
+
+// Everything Scene::getColor does but tracing the shadow and reflection
+// rays. With shadows, the light terms are only added once it is known which
+// lights reach the hit (see accumulate).
+void Wavefront::shade(unsigned bounce) {
+  unsigned numLights = scene.lights.size();
+  if (scene.renderShadows)
+    light.resize(rays.size() * numLights);
+
+#pragma omp parallel for schedule(dynamic, 64)
+  for (size_t idx = 0; idx < rays.size(); ++idx) {
+    Object *obj = hits.object[idx];
+    if (!obj)
+      continue;
+
+    Ray ray = rays.ray(idx);
+    Material const &material = obj->material;
+    Point hit = ray.at(hits.t[idx]);
+    Vector N(hits.N[0][idx], hits.N[1][idx], hits.N[2][idx]);
+    Vector V = -ray.D;
+    Vector NHat = N.normalized();
+    Vector VHat = V.normalized();
+    for (int axis = 0; axis != 3; ++axis)
+      hits.P[axis][idx] = hit.data[axis];
+
+    Vector dPdx, dPdy;
+    rays.differentials[idx].transfer(ray, hits.t[idx], N, dPdx, dPdy);
+    Color materialColor = scene.surfaceColor(obj, material, hit, dPdx, dPdy);
+    Color color = scene.ambientTerm(material, materialColor);
+
+    for (unsigned lightIdx = 0; lightIdx != numLights; ++lightIdx) {
+      Light const &lightSource = *scene.lights[lightIdx];
+      Vector L = (lightSource.position - hit).normalized();
+      double lightDistance = (lightSource.position - hit).length();
+
+      Color diffuse, specular;
+      scene.lightTerms(material, materialColor, NHat, VHat, L, lightSource,
+                       diffuse, specular);
+      if (!scene.renderShadows) {
+        color += diffuse;
+        color += specular;
+        continue;
+      }
+
+      size_t slot = idx * numLights + lightIdx;
+      for (int axis = 0; axis != 3; ++axis)
+        light.L[axis][slot] = L.data[axis];
+      light.distance[slot] = lightDistance;
+      light.diffuse[slot] = diffuse;
+      light.specular[slot] = specular;
+    }
+
+    size_t slot = size_t(bounce) * numPaths + rays.path[idx];
+    local[slot] = color;
+    ks[slot] = material.ks;
+  }
+}
+
+void Wavefront::resolveShadows() {
+  unsigned numLights = scene.lights.size();
+
+#pragma omp parallel for schedule(dynamic, 64)
+  for (size_t idx = 0; idx < rays.size(); ++idx) {
+    if (!hits.object[idx])
+      continue;
+
+    Point hit(hits.P[0][idx], hits.P[1][idx], hits.P[2][idx]);
+    Vector N(hits.N[0][idx], hits.N[1][idx], hits.N[2][idx]);
+    for (unsigned lightIdx = 0; lightIdx != numLights; ++lightIdx) {
+      size_t slot = idx * numLights + lightIdx;
+      Vector L(light.L[0][slot], light.L[1][slot], light.L[2][slot]);
+      light.blocked[slot] =
+          scene.inShadow(hit, N, L, light.distance[slot], lightIdx);
+    }
+  }
+}
+
+// Adds the light of the lights reaching the hits, in the order of the lights
+void Wavefront::accumulate(unsigned bounce) {
+  unsigned numLights = scene.lights.size();
+
+#pragma omp parallel for
+  for (size_t idx = 0; idx < rays.size(); ++idx) {
+    if (!hits.object[idx])
+      continue;
+
+    Color &color = local[size_t(bounce) * numPaths + rays.path[idx]];
+    for (unsigned lightIdx = 0; lightIdx != numLights; ++lightIdx) {
+      size_t slot = idx * numLights + lightIdx;
+      if (light.blocked[slot])
+        continue;
+      color += light.diffuse[slot];
+      color += light.specular[slot];
+    }
+  }
+}
+
+// Replaces the rays by the reflections of those that hit something
+void Wavefront::emitReflections() {
+  offsets.resize(rays.size());
+  size_t count = 0;
+  for (size_t idx = 0; idx != rays.size(); ++idx) {
+    offsets[idx] = count;
+    if (hits.object[idx])
+      ++count;
+  }
+  reflections.resize(count);
+
+#pragma omp parallel for
+  for (size_t idx = 0; idx < rays.size(); ++idx) {
+    if (!hits.object[idx])
+      continue;
+
+    Point hit(hits.P[0][idx], hits.P[1][idx], hits.P[2][idx]);
+    Vector N(hits.N[0][idx], hits.N[1][idx], hits.N[2][idx]);
+    reflections.set(offsets[idx], scene.reflectionRay(rays.ray(idx), hit, N),
+                    rays.differentials[idx].reflect(rays.ray(idx),
+                                                    hits.t[idx], N),
+                    rays.path[idx]);
+  }
+
+  swap(rays, reflections);
+}
+
+void Wavefront::resolve(Image &img, unsigned firstPixel, unsigned numPixels,
+                        unsigned samples) {
+  unsigned w = img.width();
+
+#pragma omp parallel for
+  for (unsigned pixel = 0; pixel < numPixels; ++pixel) {
+    Color col(0., 0., 0.);
+    for (unsigned sample = 0; sample != samples; ++sample) {
+      unsigned path = pixel * samples + sample;
+
+      // Add the reflected light from the deepest bounce up, in the same
+      // order as the recursion of Scene::trace does
+      Color color(0.0, 0.0, 0.0);
+      for (unsigned bounce = numBounces; bounce-- != 0;) {
+        size_t slot = size_t(bounce) * numPaths + path;
+        Color reflected = color;
+        color = local[slot];
+        color += ks[slot] * reflected;
+      }
+      col += color;
+    }
+    // Average the colors over the samples
+    col /= scene.ssFactor * scene.ssFactor;
+
+    col.clamp();
+    unsigned idx = firstPixel + pixel;
+    img.put_pixel(idx % w, idx / w, col);
+  }
+}
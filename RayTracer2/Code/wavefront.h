@@ -0,0 +1,89 @@
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include "ray.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <vector>
+
+class Image;
+class Object;
+class Scene;
+
+// Renders a scene breadth first instead of following each ray down its
+// reflections. The samples of the image are rendered in waves. Within a wave
+// every stage (generating the primary rays, finding the closest hits, shading
+// them while emitting shadow rays, resolving the shadow rays, emitting the
+// reflections) runs over all rays of the wave, in parallel, before the next
+// stage starts. The image is the same as the one Scene::trace gives.
+class Wavefront {
+public:
+  explicit Wavefront(Scene &scene);
+
+  void render(Image &img);
+
+private:
+  // Rays stored per component, each extending one path (sample) of the wave
+  struct RayQueue {
+    std::vector<double> O[3];
+    std::vector<double> D[3];
+    std::vector<unsigned> path;
+    std::vector<RayDifferentials> differentials;
+
+    size_t size() const { return path.size(); }
+    void resize(size_t size);
+    void set(size_t idx, Ray const &ray,
+             RayDifferentials const &differentials, unsigned path);
+    Ray ray(size_t idx) const;
+  };
+
+  // Closest hits of the rays in the queue, by the index of the ray
+  struct HitQueue {
+    std::vector<Object *> object; // nullptr if the ray hit nothing
+    std::vector<double> t;
+    std::vector<double> N[3];
+    std::vector<double> P[3]; // the hit point, set while shading
+
+    void resize(size_t size);
+  };
+
+  // Light arriving at the hits, by hit index * number of lights + light. The
+  // terms only count when the shadow ray to the light is not blocked.
+  struct LightQueue {
+    std::vector<double> L[3]; // normalized direction to the light
+    std::vector<double> distance;
+    std::vector<Color> diffuse;
+    std::vector<Color> specular;
+    std::vector<uint8_t> blocked;
+
+    void resize(size_t size);
+  };
+
+  Scene &scene;
+
+  unsigned numPaths = 0;   // paths (samples) in the current wave
+  unsigned numBounces = 0; // rays along a path, at most
+  RayQueue rays;           // rays of the current bounce
+  RayQueue reflections;    // rays of the next bounce
+  std::vector<size_t> offsets; // index of the reflection of each ray
+  HitQueue hits;
+  LightQueue light;
+
+  // Per bounce and path the color of the hit without the reflected light,
+  // and the fraction of the reflected light that is added to it
+  std::vector<Color> local;
+  std::vector<double> ks;
+
+  void generate(Image const &img, unsigned firstPixel, unsigned numPixels,
+                unsigned samples);
+  void intersect();
+  void shade(unsigned bounce);
+  void resolveShadows();
+  void accumulate(unsigned bounce);
+  void emitReflections();
+  void resolve(Image &img, unsigned firstPixel, unsigned numPixels,
+               unsigned samples);
+};
+
+#endif
@@ -0,0 +1,90 @@
+// Converts a model to the binary mesh format (see Code/binarymesh.h): the
+// corners of the faces become an index buffer into the unique vertices.
+// The model is read with OBJLoader, so a binary mesh can be converted again,
+// e.g. after the format changed.
+//
+// usage: meshconvert in-file.obj out-file.bmesh
+
+#include "../Code/binarymesh.h"
+#include "../Code/mappedfile.h"
+#include "../Code/objloader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+void writeArray(ostream &out, vector<float> const &values, uint64_t offset) {
+  vector<char> padding(offset - out.tellp(), 0);
+  out.write(padding.data(), padding.size());
+  out.write(reinterpret_cast<char const *>(values.data()),
+            values.size() * sizeof(float));
+}
+} // namespace
+
+int main(int argc, char *argv[]) try {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " in-file.obj out-file.bmesh\n";
+    return 1;
+  }
+
+  OBJLoader model(argv[1]);
+  vector<Vertex> vertices;
+  vector<unsigned> indices;
+  model.indexed_data(vertices, indices);
+
+  BinaryMeshHeader header;
+  header.flags = (model.hasNormals() ? BinaryMeshHeader::NORMALS : 0) |
+                 (model.hasTexCoords() ? BinaryMeshHeader::TEX_COORDS : 0);
+  header.numVertices = vertices.size();
+  header.numIndices = indices.size() / 3 * 3; // whole triangles
+  header.layout();
+
+  // The components of the vertices, array by array
+  vector<float> positions, normals, texCoords;
+  for (int axis = 0; axis != 3; ++axis) {
+    header.bounds[axis] = numeric_limits<float>::infinity();
+    header.bounds[3 + axis] = -numeric_limits<float>::infinity();
+  }
+  for (Vertex const &vertex : vertices) {
+    float const position[3] = {vertex.x, vertex.y, vertex.z};
+    for (int axis = 0; axis != 3; ++axis) {
+      positions.push_back(position[axis]);
+      header.bounds[axis] = min(header.bounds[axis], position[axis]);
+      header.bounds[3 + axis] = max(header.bounds[3 + axis], position[axis]);
+    }
+    if (header.flags & BinaryMeshHeader::NORMALS)
+      normals.insert(normals.end(), {vertex.nx, vertex.ny, vertex.nz});
+    if (header.flags & BinaryMeshHeader::TEX_COORDS)
+      texCoords.insert(texCoords.end(), {vertex.u, vertex.v});
+  }
+
+  // Through a temporary file, so a failed conversion leaves no file
+  bool written = writeAtomically(argv[2], [&](ostream &out) {
+    out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    writeArray(out, positions, header.positionsOffset);
+    if (header.normalsOffset)
+      writeArray(out, normals, header.normalsOffset);
+    if (header.texCoordsOffset)
+      writeArray(out, texCoords, header.texCoordsOffset);
+    vector<char> padding(header.indicesOffset - out.tellp(), 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<char const *>(indices.data()),
+              header.numIndices * sizeof(uint32_t));
+  });
+  if (!written)
+    throw runtime_error("Could not write " + string(argv[2]) + ".");
+
+  cout << "Wrote " << header.numIndices / 3 << " triangles, "
+       << header.numVertices << " vertices (from " << indices.size()
+       << " corners), " << header.fileSize / 1024 << " KiB to " << argv[2]
+       << ".\n";
+  return 0;
+} catch (exception const &ex) {
+  cerr << ex.what() << '\n';
+  return 1;
+}
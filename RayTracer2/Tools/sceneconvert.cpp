@@ -0,0 +1,424 @@
+// Converts a scene file to the binary scene format (see Code/binaryscene.h),
+// or a binary scene back to .json. A .json scene is read with JsonReader,
+// one object at a time, so huge scenes can be converted.
+//
+// With --verify, every .json scene given is converted to a binary scene,
+// which is read back, converted to .json and again to a binary scene. The
+// scene passes if both binary scenes are the same and everything read back
+// is in the original file (which may hold more, e.g. comments).
+//
+// usage: sceneconvert in-file.json out-file.bscene
+//        sceneconvert in-file.bscene out-file.json
+//        sceneconvert --verify scene-file.json...
+
+#include "../Code/binaryscene.h"
+#include "../Code/jsonreader.h"
+#include "../Code/mappedfile.h"
+#include "../Code/triple.h"
+
+#include "../Code/json/json.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+// Builds a binary scene from the parts of a .json scene
+class Encoder {
+public:
+  explicit Encoder(json const &settings); // the eye, lights and settings
+
+  bool addObject(json const &node); // false for an unknown type
+  vector<char> finish() const;      // the contents of the file
+
+private:
+  BinaryScene::Header d_header = {};
+  vector<BinaryScene::Light> d_lights;
+  vector<BinaryScene::Material> d_materials;
+  map<string, uint32_t> d_materialIndex; // by the bytes of the record
+  vector<BinaryScene::Object> d_objects;
+  vector<string> d_strings;
+  map<string, uint32_t> d_stringIndex;
+
+  uint32_t addString(json const &node); // a string of the scene
+  uint32_t addMaterial(json const &node);
+};
+
+void setTriple(json const &node, double *values) {
+  Triple triple(node);
+  for (int axis = 0; axis != 3; ++axis)
+    values[axis] = triple.data[axis];
+}
+
+Encoder::Encoder(json const &settings) {
+  typedef BinaryScene::Header Header;
+  setTriple(settings.at("Eye"), d_header.eye);
+  d_header.textureFilter = d_header.accelerator = BinaryScene::NONE;
+  d_header.meshCacheDirectory = BinaryScene::NONE;
+  d_header.textureCacheDirectory = BinaryScene::NONE;
+
+  // The settings given, as pointers to their values
+  auto given = [&](char const *key, Header::Settings bit) -> json const * {
+    auto found = settings.find(key);
+    if (found == settings.end())
+      return nullptr;
+    d_header.settings |= bit;
+    return &*found;
+  };
+
+  if (auto value = given("Shadows", Header::SHADOWS))
+    d_header.shadows = bool(*value);
+  if (auto value = given("SuperSamplingFactor", Header::SUPER_SAMPLING_FACTOR))
+    d_header.superSamplingFactor = *value;
+  if (auto value = given("MaxRecursionDepth", Header::MAX_RECURSION_DEPTH))
+    d_header.maxRecursionDepth = *value;
+  if (auto value = given("PacketSize", Header::PACKET_SIZE))
+    d_header.packetSize = *value;
+  if (auto value = given("Wavefront", Header::WAVEFRONT))
+    d_header.wavefront = bool(*value);
+  if (auto value = given("TextureFilter", Header::TEXTURE_FILTER))
+    d_header.textureFilter = addString(*value);
+  if (auto value = given("Accelerator", Header::ACCELERATOR))
+    d_header.accelerator = addString(*value);
+  if (auto value = given("MeshCache", Header::MESH_CACHE))
+    d_header.meshCache = bool(*value);
+  if (auto value = given("MeshCacheDirectory", Header::MESH_CACHE_DIRECTORY))
+    d_header.meshCacheDirectory = addString(*value);
+  if (auto value = given("TextureCache", Header::TEXTURE_CACHE))
+    d_header.textureCache = bool(*value);
+  if (auto value =
+          given("TextureCacheDirectory", Header::TEXTURE_CACHE_DIRECTORY))
+    d_header.textureCacheDirectory = addString(*value);
+  if (auto value = given("TextureMemory", Header::TEXTURE_MEMORY))
+    d_header.textureMemory = *value;
+
+  auto lights = settings.find("Lights");
+  if (lights != settings.end()) {
+    for (json const &node : *lights) {
+      BinaryScene::Light light;
+      setTriple(node.at("position"), light.position);
+      setTriple(node.at("color"), light.color);
+      d_lights.push_back(light);
+    }
+  }
+}
+
+bool Encoder::addObject(json const &node) {
+  BinaryScene::Object object = {};
+  object.model = BinaryScene::NONE;
+  double *values = object.values;
+
+  string type = node.at("type");
+  if (type == "sphere" || type == "mesh") {
+    setTriple(node.at("position"), values);
+    if (type == "sphere") {
+      object.type = BinaryScene::SPHERE;
+      values[3] = node.at("radius");
+    } else {
+      object.type = BinaryScene::MESH;
+      object.model = addString(node.at("model"));
+      values[3] = node.at("scale");
+    }
+
+    auto rotation = node.find("rotation");
+    auto angle = node.find("angle");
+    if (rotation != node.end() && angle != node.end()) {
+      object.flags = BinaryScene::ROTATED;
+      setTriple(*rotation, values + 4);
+      values[7] = *angle;
+    }
+  } else if (type == "triangle") {
+    object.type = BinaryScene::TRIANGLE;
+    for (int vertex = 0; vertex != 3; ++vertex)
+      setTriple(node.at("vertices").at(vertex), values + 3 * vertex);
+  } else if (type == "plane") {
+    object.type = BinaryScene::PLANE;
+    setTriple(node.at("point"), values);
+    setTriple(node.at("normal"), values + 3);
+  } else if (type == "cylinder") {
+    object.type = BinaryScene::CYLINDER;
+    setTriple(node.at("pointA"), values);
+    setTriple(node.at("pointB"), values + 3);
+    values[6] = node.at("radius");
+  } else {
+    cerr << "Unknown object type: " << type << ", skipped.\n";
+    return false;
+  }
+
+  object.material = addMaterial(node.at("material"));
+  d_objects.push_back(object);
+  return true;
+}
+
+vector<char> Encoder::finish() const {
+  BinaryScene::Header header = d_header;
+  header.numLights = d_lights.size();
+  header.numMaterials = d_materials.size();
+  header.numObjects = d_objects.size();
+  header.numStrings = d_strings.size();
+  uint64_t stringsSize = 0;
+  for (string const &text : d_strings)
+    stringsSize += text.size() + 1;
+  header.layout(stringsSize);
+
+  vector<char> data(header.fileSize, 0);
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(data.data() + header.lightsOffset, d_lights.data(),
+         d_lights.size() * sizeof(BinaryScene::Light));
+  memcpy(data.data() + header.materialsOffset, d_materials.data(),
+         d_materials.size() * sizeof(BinaryScene::Material));
+  memcpy(data.data() + header.objectsOffset, d_objects.data(),
+         d_objects.size() * sizeof(BinaryScene::Object));
+
+  uint64_t offset = header.stringsOffset + d_strings.size() * sizeof(uint64_t);
+  for (size_t idx = 0; idx != d_strings.size(); ++idx) {
+    memcpy(data.data() + header.stringsOffset + idx * sizeof(uint64_t),
+           &offset, sizeof(uint64_t));
+    memcpy(data.data() + offset, d_strings[idx].c_str(),
+           d_strings[idx].size() + 1);
+    offset += d_strings[idx].size() + 1;
+  }
+  return data;
+}
+
+uint32_t Encoder::addString(json const &node) {
+  string text = node;
+  auto found = d_stringIndex.find(text);
+  if (found != d_stringIndex.end())
+    return found->second;
+  d_strings.push_back(text);
+  return d_stringIndex[text] = d_strings.size() - 1;
+}
+
+// The materials are stored once, however many objects use them
+uint32_t Encoder::addMaterial(json const &node) {
+  BinaryScene::Material material = {};
+  material.ka = node.at("ka");
+  material.kd = node.at("kd");
+  material.ks = node.at("ks");
+  material.n = node.at("n");
+  material.texture = BinaryScene::NONE;
+
+  auto texture = node.find("texture");
+  auto color = node.find("color");
+  if (texture != node.end())
+    material.texture = addString(*texture);
+  else if (color != node.end())
+    setTriple(*color, material.color);
+  else
+    throw runtime_error("No texture or color specified for material.");
+
+  string bytes(reinterpret_cast<char const *>(&material), sizeof(material));
+  auto found = d_materialIndex.find(bytes);
+  if (found != d_materialIndex.end())
+    return found->second;
+  d_materials.push_back(material);
+  return d_materialIndex[bytes] = d_materials.size() - 1;
+}
+
+// A .json scene file read as the raytracer does, see Raytracer::readScene
+vector<char> encodeFile(string const &filename) {
+  JsonReader reader(filename);
+  json settings = json::object();
+  size_t objectsOffset = 0;
+  bool hasObjects = false;
+  string key;
+  reader.beginObject();
+  while (reader.nextKey(key)) {
+    if (key == "Objects") {
+      objectsOffset = reader.offset();
+      hasObjects = true;
+      reader.skip();
+    } else {
+      settings[key] = reader.value();
+    }
+  }
+
+  Encoder encoder(settings);
+  if (hasObjects) {
+    reader.seek(objectsOffset);
+    reader.beginArray();
+    while (reader.nextElement())
+      encoder.addObject(reader.value());
+  }
+  return encoder.finish();
+}
+
+vector<char> encode(json const &scene) {
+  Encoder encoder(scene);
+  auto objects = scene.find("Objects");
+  if (objects != scene.end())
+    for (json const &node : *objects)
+      encoder.addObject(node);
+  return encoder.finish();
+}
+
+json triple(double const *values) { return {values[0], values[1], values[2]}; }
+
+// The scene as a .json scene file holding only what the raytracer reads
+json decode(BinaryScene const &file) {
+  BinaryScene::Header const &header = file.header();
+  json scene = file.settings();
+
+  for (size_t idx = 0; idx != header.numLights; ++idx) {
+    BinaryScene::Light const &light = file.lights()[idx];
+    scene["Lights"].push_back(
+        {{"position", triple(light.position)}, {"color", triple(light.color)}});
+  }
+
+  vector<json> materials;
+  for (size_t idx = 0; idx != header.numMaterials; ++idx) {
+    BinaryScene::Material const &material = file.materials()[idx];
+    json node = {{"ka", material.ka},
+                 {"kd", material.kd},
+                 {"ks", material.ks},
+                 {"n", material.n}};
+    if (material.texture != BinaryScene::NONE)
+      node["texture"] = file.text(material.texture);
+    else
+      node["color"] = triple(material.color);
+    materials.push_back(node);
+  }
+
+  for (size_t idx = 0; idx != header.numObjects; ++idx) {
+    BinaryScene::Object const &object = file.objects()[idx];
+    double const *values = object.values;
+    json node;
+    switch (object.type) {
+    case BinaryScene::SPHERE:
+      node = {{"type", "sphere"},
+              {"position", triple(values)},
+              {"radius", values[3]}};
+      break;
+    case BinaryScene::TRIANGLE:
+      node = {{"type", "triangle"},
+              {"vertices",
+               {triple(values), triple(values + 3), triple(values + 6)}}};
+      break;
+    case BinaryScene::MESH:
+      node = {{"type", "mesh"},
+              {"model", file.text(object.model)},
+              {"position", triple(values)},
+              {"scale", values[3]}};
+      break;
+    case BinaryScene::PLANE:
+      node = {{"type", "plane"},
+              {"point", triple(values)},
+              {"normal", triple(values + 3)}};
+      break;
+    case BinaryScene::CYLINDER:
+      node = {{"type", "cylinder"},
+              {"pointA", triple(values)},
+              {"pointB", triple(values + 3)},
+              {"radius", values[6]}};
+      break;
+    }
+    if (object.flags & BinaryScene::ROTATED) {
+      node["rotation"] = triple(values + 4);
+      node["angle"] = values[7];
+    }
+    node["material"] = materials[object.material];
+    scene["Objects"].push_back(node);
+  }
+  return scene;
+}
+
+// Whether everything in decoded is also in original
+bool covers(json const &original, json const &decoded) {
+  if (decoded.is_object()) {
+    if (!original.is_object())
+      return false;
+    for (auto it = decoded.begin(); it != decoded.end(); ++it) {
+      auto found = original.find(it.key());
+      if (found == original.end() || !covers(*found, it.value()))
+        return false;
+    }
+    return true;
+  }
+  if (decoded.is_array()) {
+    if (!original.is_array() || original.size() != decoded.size())
+      return false;
+    for (size_t idx = 0; idx != decoded.size(); ++idx)
+      if (!covers(original[idx], decoded[idx]))
+        return false;
+    return true;
+  }
+  return original == decoded;
+}
+
+// Through a temporary file, so a failed conversion leaves no file
+void writeFile(string const &filename, char const *data, size_t size) {
+  if (!writeAtomically(filename,
+                       [&](ostream &out) { out.write(data, size); }))
+    throw runtime_error("Could not write " + filename + ".");
+}
+
+bool verify(string const &filename) {
+  vector<char> binary = encodeFile(filename);
+
+  ostringstream tmpname;
+  tmpname << ".sceneconvert" << getpid() << ".bscene";
+  writeFile(tmpname.str(), binary.data(), binary.size());
+  json decoded;
+  try {
+    decoded = decode(BinaryScene(tmpname.str()));
+  } catch (...) {
+    remove(tmpname.str().c_str());
+    throw;
+  }
+  remove(tmpname.str().c_str());
+
+  ifstream in(filename);
+  json original;
+  in >> original;
+  bool valid = encode(decoded) == binary && covers(original, decoded);
+  cout << (valid ? "OK " : "FAILED ") << filename << " ("
+       << decoded["Objects"].size() << " objects, " << binary.size()
+       << " bytes).\n";
+  return valid;
+}
+} // namespace
+
+int main(int argc, char *argv[]) try {
+  if (argc >= 2 && string(argv[1]) == "--verify") {
+    bool valid = true;
+    for (int arg = 2; arg < argc; ++arg)
+      valid = verify(argv[arg]) && valid;
+    return valid ? 0 : 1;
+  }
+
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " in-file.json out-file.bscene\n"
+         << "       " << argv[0] << " in-file.bscene out-file.json\n"
+         << "       " << argv[0] << " --verify scene-file.json...\n";
+    return 1;
+  }
+
+  if (BinaryScene::matches(argv[1])) {
+    BinaryScene file(argv[1]);
+    string text = decode(file).dump(4) + '\n';
+    writeFile(argv[2], text.data(), text.size());
+    cout << "Wrote " << file.header().numObjects << " objects to " << argv[2]
+         << ".\n";
+  } else {
+    vector<char> binary = encodeFile(argv[1]);
+    writeFile(argv[2], binary.data(), binary.size());
+    BinaryScene::Header header;
+    memcpy(&header, binary.data(), sizeof(header));
+    cout << "Wrote " << header.numObjects << " objects, "
+         << header.numMaterials << " materials, " << binary.size() / 1024
+         << " KiB to " << argv[2] << ".\n";
+  }
+  return 0;
+} catch (exception const &ex) {
+  cerr << ex.what() << '\n';
+  return 1;
+}